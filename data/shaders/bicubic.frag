@@ -6,10 +6,27 @@ uniform float textureHeight;
 uniform float texelWidth;
 uniform float texelHeight;
 
+#ifdef YUV_INPUT
+uniform sampler2D textureSamplerU;
+uniform sampler2D textureSamplerV;
+uniform mat4 yuvToRgbMatrix;
+#endif
+
 in vec2 textureCoordinate;
 
 out vec3 color;
 
+// textureSampler holds either RGBA data or the Y plane (U and V planes have their own textures)
+vec4 sampleTexture(vec2 coordinate)
+{
+#ifdef YUV_INPUT
+	vec4 yuv = vec4(texture(textureSampler, coordinate).r, texture(textureSamplerU, coordinate).r, texture(textureSamplerV, coordinate).r, 1.0f);
+	return yuvToRgbMatrix * yuv;
+#else
+	return texture(textureSampler, coordinate);
+#endif
+}
+
 // select one
 // triangle, bell, bspline, catmullrom, lanczos
 #define INTERPOLATION_FUNCTION lanczos
@@ -128,7 +145,7 @@ void main()
 	{
 		for(int y = -1; y <= 2; y++)
 		{
-			vec4 color = texture(textureSampler, snappedTextureCoordinate + vec2(texelWidth * float(x), texelHeight * float(y)));
+			vec4 color = sampleTexture(snappedTextureCoordinate + vec2(texelWidth * float(x), texelHeight * float(y)));
 				
 			float f1 = INTERPOLATION_FUNCTION(float(x) - alphaX); // argument range is -2.0f - 2.0f
 			float f2 = INTERPOLATION_FUNCTION((float(y) - alphaY));  // argument range is -2.0f - 2.0f
@@ -6,10 +6,27 @@ uniform float textureHeight;
 uniform float texelWidth;
 uniform float texelHeight;
 
+#ifdef YUV_INPUT
+uniform sampler2D textureSamplerU;
+uniform sampler2D textureSamplerV;
+uniform mat4 yuvToRgbMatrix;
+#endif
+
 in vec2 textureCoordinate;
 
 out vec3 color;
 
+// textureSampler holds either RGBA data or the Y plane (U and V planes have their own textures)
+vec4 sampleTexture(vec2 coordinate)
+{
+#ifdef YUV_INPUT
+	vec4 yuv = vec4(texture(textureSampler, coordinate).r, texture(textureSamplerU, coordinate).r, texture(textureSamplerV, coordinate).r, 1.0f);
+	return yuvToRgbMatrix * yuv;
+#else
+	return texture(textureSampler, coordinate);
+#endif
+}
+
 void main()
 {
 	// round up to the nearest texel center (this avoids hardware bilinear)
@@ -22,10 +39,10 @@ void main()
 	vec2 snappedTextureCoordinate = vec2(tx / textureWidth, ty / textureHeight);
 
 	// take color samples from four nearest texel centers
-	vec4 tl = texture(textureSampler, snappedTextureCoordinate);
-	vec4 tr = texture(textureSampler, snappedTextureCoordinate + vec2(texelWidth, 0));
-	vec4 bl = texture(textureSampler, snappedTextureCoordinate + vec2(0, texelHeight));
-	vec4 br = texture(textureSampler, snappedTextureCoordinate + vec2(texelWidth, texelHeight));
+	vec4 tl = sampleTexture(snappedTextureCoordinate);
+	vec4 tr = sampleTexture(snappedTextureCoordinate + vec2(texelWidth, 0));
+	vec4 bl = sampleTexture(snappedTextureCoordinate + vec2(0, texelHeight));
+	vec4 br = sampleTexture(snappedTextureCoordinate + vec2(texelWidth, texelHeight));
 
 	float alphaX = fract(textureCoordinate.x * textureWidth);
 	float alphaY = fract(textureCoordinate.y * textureHeight);
@@ -2,11 +2,28 @@
 
 uniform sampler2D textureSampler;
 
+#ifdef YUV_INPUT
+uniform sampler2D textureSamplerU;
+uniform sampler2D textureSamplerV;
+uniform mat4 yuvToRgbMatrix;
+#endif
+
 in vec2 textureCoordinate;
 
 out vec3 color;
 
+// textureSampler holds either RGBA data or the Y plane (U and V planes have their own textures)
+vec4 sampleTexture(vec2 coordinate)
+{
+#ifdef YUV_INPUT
+	vec4 yuv = vec4(texture(textureSampler, coordinate).r, texture(textureSamplerU, coordinate).r, texture(textureSamplerV, coordinate).r, 1.0f);
+	return yuvToRgbMatrix * yuv;
+#else
+	return texture(textureSampler, coordinate);
+#endif
+}
+
 void main()
 {
-	color = texture(textureSampler, textureCoordinate).rgb;
+	color = sampleTexture(textureCoordinate).rgb;
 }
@@ -2,9 +2,26 @@
 
 uniform sampler2D textureSampler;
 
+#ifdef YUV_INPUT
+uniform sampler2D textureSamplerU;
+uniform sampler2D textureSamplerV;
+uniform mat4 yuvToRgbMatrix;
+#endif
+
 varying vec2 textureCoordinate;
 
+// textureSampler holds either RGBA data or the Y plane (U and V planes have their own textures)
+vec4 sampleTexture(vec2 coordinate)
+{
+#ifdef YUV_INPUT
+	vec4 yuv = vec4(texture2D(textureSampler, coordinate).r, texture2D(textureSamplerU, coordinate).r, texture2D(textureSamplerV, coordinate).r, 1.0);
+	return yuvToRgbMatrix * yuv;
+#else
+	return texture2D(textureSampler, coordinate);
+#endif
+}
+
 void main()
 {
-	gl_FragColor = texture2D(textureSampler, textureCoordinate);
+	gl_FragColor = sampleTexture(textureCoordinate);
 }
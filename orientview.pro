@@ -44,13 +44,25 @@ UI_DIR = build
 
 HEADERS  += \
     src/EncodeWindow.h \
+    src/BoundedQueue.h \
+    src/BoxDownscaler.h \
+    src/FeatureTracker.h \
+    src/FrameCache.h \
+    src/FrameConverter.h \
     src/FrameData.h \
+    src/FramePool.h \
+    src/FramePositionSmoother.h \
     src/GpxReader.h \
+    src/GyroDataReader.h \
     src/InputHandler.h \
     src/MainWindow.h \
     src/MapImageReader.h \
+    src/MotionVectorEstimator.h \
     src/MovingAverage.h \
     src/Mp4File.h \
+    src/PacketQueue.h \
+    src/ParallelTaskRunner.h \
+    src/PhaseCorrelator.h \
     src/QuickRouteReader.h \
     src/Renderer.h \
     src/RenderOffScreenThread.h \
@@ -60,24 +72,39 @@ HEADERS  += \
     src/Settings.h \
     src/SimpleLogger.h \
     src/SplitTimeManager.h \
+    src/StabilizationDataFile.h \
     src/StabilizeWindow.h \
     src/VideoDecoder.h \
     src/VideoDecoderThread.h \
+    src/VideoDemuxerThread.h \
     src/VideoEncoder.h \
     src/VideoEncoderThread.h \
+    src/VideoFileReader.h \
+    src/VideoInput.h \
     src/VideoStabilizer.h \
     src/VideoStabilizerThread.h \
     src/VideoWindow.h
 
 SOURCES += \
+    src/BoxDownscaler.cpp \
     src/EncodeWindow.cpp \
+    src/FeatureTracker.cpp \
+    src/FrameCache.cpp \
+    src/FrameConverter.cpp \
+    src/FramePool.cpp \
+    src/FramePositionSmoother.cpp \
     src/GpxReader.cpp \
+    src/GyroDataReader.cpp \
     src/InputHandler.cpp \
     src/Main.cpp \
     src/MainWindow.cpp \
     src/MapImageReader.cpp \
+    src/MotionVectorEstimator.cpp \
     src/MovingAverage.cpp \
     src/Mp4File.cpp \
+    src/PacketQueue.cpp \
+    src/ParallelTaskRunner.cpp \
+    src/PhaseCorrelator.cpp \
     src/QuickRouteReader.cpp \
     src/Renderer.cpp \
     src/RenderOffScreenThread.cpp \
@@ -86,11 +113,15 @@ SOURCES += \
     src/Settings.cpp \
     src/SimpleLogger.cpp \
     src/SplitTimeManager.cpp \
+    src/StabilizationDataFile.cpp \
     src/StabilizeWindow.cpp \
     src/VideoDecoder.cpp \
     src/VideoDecoderThread.cpp \
+    src/VideoDemuxerThread.cpp \
     src/VideoEncoder.cpp \
     src/VideoEncoderThread.cpp \
+    src/VideoFileReader.cpp \
+    src/VideoInput.cpp \
     src/VideoStabilizer.cpp \
     src/VideoStabilizerThread.cpp \
     src/VideoWindow.cpp
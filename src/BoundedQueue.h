@@ -0,0 +1,74 @@
+// Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: GPLv3, see the LICENSE file.
+
+#pragma once
+
+#include <deque>
+
+#include <QMutex>
+#include <QSemaphore>
+
+namespace OrientView
+{
+	// Thread safe fixed capacity FIFO queue for passing items from one stage to another.
+	template <typename T>
+	class BoundedQueue
+	{
+
+	public:
+
+		void initialize(int capacity)
+		{
+			this->capacity = capacity;
+			freeSlotSemaphore.release(capacity);
+		}
+
+		bool tryPush(const T& item, int timeout)
+		{
+			if (!freeSlotSemaphore.tryAcquire(1, timeout))
+				return false;
+
+			{
+				QMutexLocker locker(&queueMutex);
+				items.push_back(item);
+			}
+
+			usedSlotSemaphore.release(1);
+			return true;
+		}
+
+		bool tryPop(T& item, int timeout)
+		{
+			if (!usedSlotSemaphore.tryAcquire(1, timeout))
+				return false;
+
+			{
+				QMutexLocker locker(&queueMutex);
+				item = items.front();
+				items.pop_front();
+			}
+
+			freeSlotSemaphore.release(1);
+			return true;
+		}
+
+		int getCount() const
+		{
+			return usedSlotSemaphore.available();
+		}
+
+		int getCapacity() const
+		{
+			return capacity;
+		}
+
+	private:
+
+		QMutex queueMutex;
+		QSemaphore freeSlotSemaphore;
+		QSemaphore usedSlotSemaphore;
+
+		std::deque<T> items;
+		int capacity = 0;
+	};
+}
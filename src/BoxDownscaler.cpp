@@ -0,0 +1,173 @@
+// Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: GPLv3, see the LICENSE file.
+
+#include <cstddef>
+
+#include <QtGlobal>
+#include <QElapsedTimer>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define BOX_DOWNSCALER_AVX2
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BOX_DOWNSCALER_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define BOX_DOWNSCALER_NEON
+#endif
+
+#include "BoxDownscaler.h"
+
+using namespace OrientView;
+
+namespace
+{
+	// add up the same column of the given rows, this is where most of the pixels are touched
+	void sumRows(const uint8_t* sourceData, int sourceLineSize, int rowCount, int width, uint16_t* columnSums)
+	{
+		int x = 0;
+
+#ifdef BOX_DOWNSCALER_AVX2
+		for (; x + 32 <= width; x += 32)
+		{
+			__m256i sumLow = _mm256_setzero_si256();
+			__m256i sumHigh = _mm256_setzero_si256();
+
+			for (int y = 0; y < rowCount; ++y)
+			{
+				const uint8_t* row = sourceData + (ptrdiff_t)y * sourceLineSize + x;
+
+				sumLow = _mm256_add_epi16(sumLow, _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)row)));
+				sumHigh = _mm256_add_epi16(sumHigh, _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(row + 16))));
+			}
+
+			_mm256_storeu_si256((__m256i*)(columnSums + x), sumLow);
+			_mm256_storeu_si256((__m256i*)(columnSums + x + 16), sumHigh);
+		}
+#endif
+
+#if defined(BOX_DOWNSCALER_SSE2)
+		const __m128i zero = _mm_setzero_si128();
+
+		for (; x + 16 <= width; x += 16)
+		{
+			__m128i sumLow = _mm_setzero_si128();
+			__m128i sumHigh = _mm_setzero_si128();
+
+			for (int y = 0; y < rowCount; ++y)
+			{
+				__m128i pixels = _mm_loadu_si128((const __m128i*)(sourceData + (ptrdiff_t)y * sourceLineSize + x));
+
+				sumLow = _mm_add_epi16(sumLow, _mm_unpacklo_epi8(pixels, zero));
+				sumHigh = _mm_add_epi16(sumHigh, _mm_unpackhi_epi8(pixels, zero));
+			}
+
+			_mm_storeu_si128((__m128i*)(columnSums + x), sumLow);
+			_mm_storeu_si128((__m128i*)(columnSums + x + 8), sumHigh);
+		}
+#elif defined(BOX_DOWNSCALER_NEON)
+		for (; x + 16 <= width; x += 16)
+		{
+			uint16x8_t sumLow = vdupq_n_u16(0);
+			uint16x8_t sumHigh = vdupq_n_u16(0);
+
+			for (int y = 0; y < rowCount; ++y)
+			{
+				uint8x16_t pixels = vld1q_u8(sourceData + (ptrdiff_t)y * sourceLineSize + x);
+
+				sumLow = vaddw_u8(sumLow, vget_low_u8(pixels));
+				sumHigh = vaddw_u8(sumHigh, vget_high_u8(pixels));
+			}
+
+			vst1q_u16(columnSums + x, sumLow);
+			vst1q_u16(columnSums + x + 8, sumHigh);
+		}
+#endif
+
+		for (; x < width; ++x)
+		{
+			uint16_t sum = 0;
+
+			for (int y = 0; y < rowCount; ++y)
+				sum += sourceData[(ptrdiff_t)y * sourceLineSize + x];
+
+			columnSums[x] = sum;
+		}
+	}
+}
+
+bool BoxDownscaler::initialize(int targetWidth, int targetHeight, int factor)
+{
+	// the column sums are 16-bit
+	if (factor < 1 || factor > 256 || targetWidth <= 0 || targetHeight <= 0)
+	{
+		qWarning("Could not initialize box downscaler");
+		return false;
+	}
+
+	this->targetWidth = targetWidth;
+	this->targetHeight = targetHeight;
+	this->factor = factor;
+
+	columnSums.resize((size_t)(targetWidth * factor));
+
+	return true;
+}
+
+void BoxDownscaler::downscale(const uint8_t* sourceData, int sourceLineSize, uint8_t* targetData, int targetLineSize)
+{
+	const uint32_t area = (uint32_t)(factor * factor);
+	const uint32_t rounding = area / 2;
+
+	for (int y = 0; y < targetHeight; ++y)
+	{
+		sumRows(sourceData + (ptrdiff_t)y * factor * sourceLineSize, sourceLineSize, factor, targetWidth * factor, &columnSums[0]);
+
+		const uint16_t* columnSum = &columnSums[0];
+		uint8_t* targetRow = targetData + (ptrdiff_t)y * targetLineSize;
+
+		for (int x = 0; x < targetWidth; ++x)
+		{
+			uint32_t sum = 0;
+
+			for (int i = 0; i < factor; ++i)
+				sum += *columnSum++;
+
+			targetRow[x] = (uint8_t)((sum + rounding) / area);
+		}
+	}
+}
+
+void BoxDownscaler::runBenchmark()
+{
+	const int sourceWidth = 3840;
+	const int sourceHeight = 2160;
+	const int iterations = 100;
+
+	std::vector<uint8_t> sourceData((size_t)(sourceWidth * sourceHeight));
+	std::vector<uint8_t> targetData(sourceData.size());
+
+	for (size_t i = 0; i < sourceData.size(); ++i)
+		sourceData[i] = (uint8_t)(i * 31);
+
+	qDebug("Box downscaler benchmark (%d iterations)", iterations);
+
+	for (int factor = 2; factor <= 8; factor *= 2)
+	{
+		BoxDownscaler boxDownscaler;
+
+		if (!boxDownscaler.initialize(sourceWidth / factor, sourceHeight / factor, factor))
+			return;
+
+		QElapsedTimer timer;
+		timer.start();
+
+		for (int i = 0; i < iterations; ++i)
+			boxDownscaler.downscale(&sourceData[0], sourceWidth, &targetData[0], sourceWidth / factor);
+
+		qDebug("%dx%d luma by %d: %.2f ms", sourceWidth, sourceHeight, factor, timer.nsecsElapsed() / 1000000.0 / iterations);
+	}
+}
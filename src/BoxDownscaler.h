@@ -0,0 +1,31 @@
+// Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: GPLv3, see the LICENSE file.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace OrientView
+{
+	// Downscale an 8-bit single channel image by an integer factor by averaging square blocks of pixels.
+	class BoxDownscaler
+	{
+
+	public:
+
+		bool initialize(int targetWidth, int targetHeight, int factor);
+
+		void downscale(const uint8_t* sourceData, int sourceLineSize, uint8_t* targetData, int targetLineSize);
+
+		static void runBenchmark();
+
+	private:
+
+		std::vector<uint16_t> columnSums;
+
+		int targetWidth = 0;
+		int targetHeight = 0;
+		int factor = 0;
+	};
+}
@@ -0,0 +1,216 @@
+// Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: GPLv3, see the LICENSE file.
+
+#include <algorithm>
+
+#include <QThread>
+
+#include "FeatureTracker.h"
+#include "ParallelTaskRunner.h"
+
+using namespace OrientView;
+
+namespace
+{
+	const int gridSize = 4; // tiles per side
+	const double qualityLevel = 0.01;
+	const double minDistance = 30.0;
+}
+
+void FeatureTracker::initialize(int maxFeatureCount, double minFeatureCountFactor, int threadCount)
+{
+	this->maxFeatureCount = std::max(1, maxFeatureCount);
+	minFeatureCount = (int)(this->maxFeatureCount * minFeatureCountFactor + 0.5);
+	this->threadCount = (threadCount <= 0) ? QThread::idealThreadCount() : threadCount;
+
+	tiles.resize(gridSize * gridSize);
+	flowBatches.resize(gridSize * gridSize);
+
+	// spread the features evenly, every tile gets an equal share
+	for (Tile& tile : tiles)
+		tile.featureBudget = std::max(1, (this->maxFeatureCount + (int)tiles.size() - 1) / (int)tiles.size());
+
+	reset();
+}
+
+void FeatureTracker::reset()
+{
+	hasPreviousImage = false;
+
+	trackedPoints.clear();
+	previousPoints.clear();
+	currentPoints.clear();
+}
+
+// Returns false if there is nothing to compare the image to (e.g. on the first image).
+bool FeatureTracker::track(const cv::Mat& image)
+{
+	previousPoints.clear();
+	currentPoints.clear();
+
+	// the pyramid levels are views into bordered images, so the first level is the same size as the image
+	if (hasPreviousImage && (previousPyramid.empty() || previousPyramid[0].size() != image.size()))
+		reset();
+
+	updateTiles(image.size());
+
+	// the pyramid gets its own copy of the image, so the frame can go back to its pool right after this
+	cv::buildOpticalFlowPyramid(image, currentPyramid, windowSize, maxPyramidLevel, true, cv::BORDER_REFLECT_101, cv::BORDER_CONSTANT, false);
+
+	if (hasPreviousImage && !trackedPoints.empty())
+		trackPoints();
+
+	bool hasMatches = !currentPoints.empty();
+
+	// the surviving points are tracked on from this image
+	trackedPoints.assign(currentPoints.begin(), currentPoints.end());
+
+	if ((int)trackedPoints.size() < minFeatureCount)
+		detectFeatures(image);
+
+	// the current pyramid becomes the previous one and its buffers get reused for the next image
+	std::swap(previousPyramid, currentPyramid);
+	hasPreviousImage = true;
+
+	return hasMatches;
+}
+
+const std::vector<cv::Point2f>& FeatureTracker::getPreviousPoints() const
+{
+	return previousPoints;
+}
+
+const std::vector<cv::Point2f>& FeatureTracker::getCurrentPoints() const
+{
+	return currentPoints;
+}
+
+void FeatureTracker::updateTiles(const cv::Size& imageSize)
+{
+	if (imageSize == tileImageSize)
+		return;
+
+	tileImageSize = imageSize;
+	tileSize.width = std::max(1, (imageSize.width + gridSize - 1) / gridSize);
+	tileSize.height = std::max(1, (imageSize.height + gridSize - 1) / gridSize);
+
+	cv::Rect imageRect(0, 0, imageSize.width, imageSize.height);
+
+	for (int tileY = 0; tileY < gridSize; ++tileY)
+	{
+		for (int tileX = 0; tileX < gridSize; ++tileX)
+			tiles[tileY * gridSize + tileX].rect = cv::Rect(tileX * tileSize.width, tileY * tileSize.height, tileSize.width, tileSize.height) & imageRect;
+	}
+}
+
+int FeatureTracker::getTileIndex(const cv::Point2f& point) const
+{
+	int tileX = std::max(0, std::min(gridSize - 1, (int)point.x / tileSize.width));
+	int tileY = std::max(0, std::min(gridSize - 1, (int)point.y / tileSize.height));
+
+	return tileY * gridSize + tileX;
+}
+
+// Finds the tracked points in the current image, the points of each tile in their own batch.
+void FeatureTracker::trackPoints()
+{
+	for (FlowBatch& flowBatch : flowBatches)
+		flowBatch.points.clear();
+
+	for (const cv::Point2f& point : trackedPoints)
+		flowBatches[getTileIndex(point)].points.push_back(point);
+
+	flowBatchIndices.clear();
+
+	for (size_t i = 0; i < flowBatches.size(); ++i)
+	{
+		if (!flowBatches[i].points.empty())
+			flowBatchIndices.push_back((int)i);
+	}
+
+	// the pyramids are only read here, so the batches can share them
+	ParallelTaskRunner::run((int)flowBatchIndices.size(), threadCount, [this](int taskIndex)
+	{
+		FlowBatch& flowBatch = flowBatches[flowBatchIndices[taskIndex]];
+		cv::calcOpticalFlowPyrLK(previousPyramid, currentPyramid, flowBatch.points, flowBatch.flowPoints, flowBatch.status, flowBatch.error, windowSize, maxPyramidLevel);
+	});
+
+	cv::Rect imageRect(0, 0, tileImageSize.width, tileImageSize.height);
+
+	// keep the points which had a good match and stayed inside the image
+	for (int flowBatchIndex : flowBatchIndices)
+	{
+		const FlowBatch& flowBatch = flowBatches[flowBatchIndex];
+
+		for (size_t i = 0; i < flowBatch.status.size(); ++i)
+		{
+			if (flowBatch.status[i] != 0 && imageRect.contains(flowBatch.flowPoints[i]))
+			{
+				previousPoints.push_back(flowBatch.points[i]);
+				currentPoints.push_back(flowBatch.flowPoints[i]);
+			}
+		}
+	}
+}
+
+// Adds new points to the tiles which have lost most of theirs, keeping clear of the points still being tracked.
+void FeatureTracker::detectFeatures(const cv::Mat& image)
+{
+	std::vector<int> tilePointCounts(tiles.size(), 0);
+
+	for (const cv::Point2f& point : trackedPoints)
+		tilePointCounts[getTileIndex(point)]++;
+
+	detectionTileIndices.clear();
+
+	for (size_t i = 0; i < tiles.size(); ++i)
+	{
+		if (tiles[i].rect.area() > 0 && tilePointCounts[i] < tiles[i].featureBudget / 2)
+			detectionTileIndices.push_back((int)i);
+	}
+
+	if (detectionTileIndices.empty())
+		return;
+
+	detectionMask.create(image.rows, image.cols, CV_8UC1);
+	detectionMask.setTo(cv::Scalar(255));
+
+	for (const cv::Point2f& point : trackedPoints)
+		cv::circle(detectionMask, point, (int)minDistance, cv::Scalar(0), -1);
+
+	// the quality level is relative to the best corner of each tile, so low contrast areas get their share too
+	ParallelTaskRunner::run((int)detectionTileIndices.size(), threadCount, [&](int taskIndex)
+	{
+		int tileIndex = detectionTileIndices[taskIndex];
+		Tile& tile = tiles[tileIndex];
+
+		cv::goodFeaturesToTrack(image(tile.rect), tile.detectedPoints, tile.featureBudget - tilePointCounts[tileIndex], qualityLevel, minDistance, detectionMask(tile.rect));
+
+		for (cv::Point2f& point : tile.detectedPoints)
+		{
+			point.x += tile.rect.x;
+			point.y += tile.rect.y;
+		}
+	});
+
+	// the tiles only keep their own points apart, so the points near the tile borders are checked against the neighbouring tiles here
+	size_t firstNewPointIndex = trackedPoints.size();
+	double minDistanceSquared = minDistance * minDistance;
+
+	for (int tileIndex : detectionTileIndices)
+	{
+		for (const cv::Point2f& point : tiles[tileIndex].detectedPoints)
+		{
+			bool isClear = true;
+
+			for (size_t i = firstNewPointIndex; i < trackedPoints.size() && isClear; ++i)
+			{
+				cv::Point2f difference = trackedPoints[i] - point;
+				isClear = (difference.dot(difference) >= minDistanceSquared);
+			}
+
+			if (isClear)
+				trackedPoints.push_back(point);
+		}
+	}
+}
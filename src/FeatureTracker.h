@@ -0,0 +1,74 @@
+// Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: GPLv3, see the LICENSE file.
+
+#pragma once
+
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+namespace OrientView
+{
+	// Track feature points from frame to frame with pyramidal Lucas-Kanade.
+	// The points and the image pyramid of the previous frame are carried over, and new points are only looked for where the tracks have been lost.
+	// The frame is divided into a grid of tiles which are detected and tracked in parallel on the shared thread pool.
+	class FeatureTracker
+	{
+
+	public:
+
+		void initialize(int maxFeatureCount, double minFeatureCountFactor, int threadCount);
+		void reset();
+
+		bool track(const cv::Mat& image);
+
+		const std::vector<cv::Point2f>& getPreviousPoints() const;
+		const std::vector<cv::Point2f>& getCurrentPoints() const;
+
+	private:
+
+		struct Tile
+		{
+			cv::Rect rect;
+			int featureBudget = 0;
+			std::vector<cv::Point2f> detectedPoints;
+		};
+
+		struct FlowBatch
+		{
+			std::vector<cv::Point2f> points; // in the previous image
+			std::vector<cv::Point2f> flowPoints; // the same points in the current image
+			std::vector<uchar> status;
+			std::vector<float> error;
+		};
+
+		void updateTiles(const cv::Size& imageSize);
+		int getTileIndex(const cv::Point2f& point) const;
+		void trackPoints();
+		void detectFeatures(const cv::Mat& image);
+
+		int maxFeatureCount = 200;
+		int minFeatureCount = 100;
+		int threadCount = 1;
+		cv::Size windowSize = cv::Size(21, 21);
+		int maxPyramidLevel = 3;
+
+		bool hasPreviousImage = false;
+
+		std::vector<cv::Mat> previousPyramid;
+		std::vector<cv::Mat> currentPyramid;
+
+		std::vector<cv::Point2f> trackedPoints; // in the previous image
+
+		std::vector<cv::Point2f> previousPoints; // matched pairs
+		std::vector<cv::Point2f> currentPoints;
+
+		cv::Size tileImageSize;
+		cv::Size tileSize;
+		std::vector<Tile> tiles;
+		std::vector<int> detectionTileIndices;
+		std::vector<FlowBatch> flowBatches; // one per tile
+		std::vector<int> flowBatchIndices;
+		cv::Mat detectionMask;
+	};
+}
@@ -0,0 +1,149 @@
+// Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: GPLv3, see the LICENSE file.
+
+#include "FrameCache.h"
+#include "FramePool.h"
+
+using namespace OrientView;
+
+void FrameCache::initialize(int maxFrameCount)
+{
+	this->maxFrameCount = maxFrameCount;
+}
+
+FrameCache::~FrameCache()
+{
+	clear();
+}
+
+void FrameCache::insert(const FrameData& frameData, const FrameData& frameDataGrayscale, bool hasPrevious, int64_t previousTimeStamp)
+{
+	// the grayscale frame may come without an image (and a pool) when no one asked for it
+	if (maxFrameCount <= 0 || frameData.pool == nullptr)
+		return;
+
+	auto existing = entries.find(frameData.timeStamp);
+
+	if (existing != entries.end())
+	{
+		releaseEntry(existing->second);
+
+		if (!hasPrevious)
+		{
+			hasPrevious = existing->second.hasPrevious;
+			previousTimeStamp = existing->second.previousTimeStamp;
+		}
+	}
+	else if ((int)entries.size() >= maxFrameCount)
+		evictLeastRecentlyUsed();
+
+	Entry& entry = entries[frameData.timeStamp];
+
+	entry.frameData = frameData;
+	entry.frameDataGrayscale = frameDataGrayscale;
+	entry.hasPrevious = hasPrevious;
+	entry.previousTimeStamp = previousTimeStamp;
+	entry.lastUsed = ++useCounter;
+
+	frameData.pool->retainFrame(frameData);
+
+	if (frameDataGrayscale.pool != nullptr)
+		frameDataGrayscale.pool->retainFrame(frameDataGrayscale);
+
+	if (hasPrevious)
+	{
+		auto previous = entries.find(previousTimeStamp);
+
+		if (previous != entries.end())
+		{
+			previous->second.hasNext = true;
+			previous->second.nextTimeStamp = frameData.timeStamp;
+		}
+	}
+}
+
+bool FrameCache::tryGetFrame(int64_t timeStamp, FrameData& frameData, FrameData& frameDataGrayscale)
+{
+	auto entry = entries.find(timeStamp);
+
+	if (entry == entries.end())
+		return false;
+
+	entry->second.lastUsed = ++useCounter;
+
+	// the caller gets its own references and releases them like any other pooled frame
+	frameData = entry->second.frameData;
+	frameDataGrayscale = entry->second.frameDataGrayscale;
+	frameData.pool->retainFrame(frameData);
+
+	if (frameDataGrayscale.pool != nullptr)
+		frameDataGrayscale.pool->retainFrame(frameDataGrayscale);
+
+	return true;
+}
+
+bool FrameCache::tryGetPreviousTimeStamp(int64_t timeStamp, int64_t& previousTimeStamp) const
+{
+	auto entry = entries.find(timeStamp);
+
+	if (entry == entries.end() || !entry->second.hasPrevious || entries.count(entry->second.previousTimeStamp) == 0)
+		return false;
+
+	previousTimeStamp = entry->second.previousTimeStamp;
+	return true;
+}
+
+bool FrameCache::tryGetNextTimeStamp(int64_t timeStamp, int64_t& nextTimeStamp) const
+{
+	auto entry = entries.find(timeStamp);
+
+	if (entry == entries.end() || !entry->second.hasNext || entries.count(entry->second.nextTimeStamp) == 0)
+		return false;
+
+	nextTimeStamp = entry->second.nextTimeStamp;
+	return true;
+}
+
+void FrameCache::clear()
+{
+	for (auto& entry : entries)
+		releaseEntry(entry.second);
+
+	entries.clear();
+}
+
+int FrameCache::getMaxFrameCount() const
+{
+	return maxFrameCount;
+}
+
+int FrameCache::getFrameCount() const
+{
+	return (int)entries.size();
+}
+
+void FrameCache::releaseEntry(Entry& entry)
+{
+	if (entry.frameData.pool != nullptr)
+		entry.frameData.pool->releaseFrame(entry.frameData);
+
+	if (entry.frameDataGrayscale.pool != nullptr)
+		entry.frameDataGrayscale.pool->releaseFrame(entry.frameDataGrayscale);
+}
+
+void FrameCache::evictLeastRecentlyUsed()
+{
+	auto leastRecentlyUsed = entries.begin();
+
+	for (auto entry = entries.begin(); entry != entries.end(); ++entry)
+	{
+		if (entry->second.lastUsed < leastRecentlyUsed->second.lastUsed)
+			leastRecentlyUsed = entry;
+	}
+
+	if (leastRecentlyUsed != entries.end())
+	{
+		releaseEntry(leastRecentlyUsed->second);
+		entries.erase(leastRecentlyUsed);
+	}
+}
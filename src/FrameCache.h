@@ -0,0 +1,53 @@
+// Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: GPLv3, see the LICENSE file.
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+
+#include "FrameData.h"
+
+namespace OrientView
+{
+	// Least recently used cache of decoded frames keyed by their time stamps.
+	// Frames are retained from their pools instead of being copied. Not thread safe.
+	class FrameCache
+	{
+
+	public:
+
+		void initialize(int maxFrameCount);
+		~FrameCache();
+
+		void insert(const FrameData& frameData, const FrameData& frameDataGrayscale, bool hasPrevious, int64_t previousTimeStamp);
+		bool tryGetFrame(int64_t timeStamp, FrameData& frameData, FrameData& frameDataGrayscale);
+		bool tryGetPreviousTimeStamp(int64_t timeStamp, int64_t& previousTimeStamp) const;
+		bool tryGetNextTimeStamp(int64_t timeStamp, int64_t& nextTimeStamp) const;
+		void clear();
+
+		int getMaxFrameCount() const;
+		int getFrameCount() const;
+
+	private:
+
+		struct Entry
+		{
+			FrameData frameData;
+			FrameData frameDataGrayscale;
+			int64_t previousTimeStamp = 0; // time stamp of the frame shown before this one
+			int64_t nextTimeStamp = 0; // time stamp of the frame shown after this one
+			bool hasPrevious = false;
+			bool hasNext = false;
+			uint64_t lastUsed = 0;
+		};
+
+		void releaseEntry(Entry& entry);
+		void evictLeastRecentlyUsed();
+
+		std::map<int64_t, Entry> entries;
+
+		int maxFrameCount = 0;
+		uint64_t useCounter = 0;
+	};
+}
@@ -0,0 +1,214 @@
+// Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: GPLv3, see the LICENSE file.
+
+#include <algorithm>
+
+#include <QtGlobal>
+#include <QElapsedTimer>
+#include <QThread>
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavutil/pixdesc.h>
+}
+
+#include "FrameConverter.h"
+#include "ParallelTaskRunner.h"
+
+using namespace OrientView;
+
+bool FrameConverter::initialize(int sourceWidth, int sourceHeight, AVPixelFormat sourcePixelFormat, int targetWidth, int targetHeight, AVPixelFormat targetPixelFormat, int threadCount)
+{
+	const AVPixFmtDescriptor* sourceDescriptor = av_pix_fmt_desc_get(sourcePixelFormat);
+	const AVPixFmtDescriptor* targetDescriptor = av_pix_fmt_desc_get(targetPixelFormat);
+
+	if (sourceDescriptor == nullptr || targetDescriptor == nullptr || sourceHeight <= 0 || targetHeight <= 0)
+	{
+		qWarning("Could not initialize frame converter");
+		return false;
+	}
+
+	if (threadCount <= 0)
+		threadCount = QThread::idealThreadCount();
+
+	// the converter can be initialized again for a new size
+	freeSlices();
+
+	sourcePlaneCount = av_pix_fmt_count_planes(sourcePixelFormat);
+	targetPlaneCount = av_pix_fmt_count_planes(targetPixelFormat);
+	sourceChromaShift = sourceDescriptor->log2_chroma_h;
+	targetChromaShift = targetDescriptor->log2_chroma_h;
+
+	// slice borders have to fall on whole source rows and on whole chroma rows on both sides
+	int sliceGranularity = 0;
+
+	for (int rows = 1; rows <= targetHeight; ++rows)
+	{
+		if (((int64_t)rows * sourceHeight) % targetHeight == 0 &&
+			rows % (1 << targetChromaShift) == 0 &&
+			((int64_t)rows * sourceHeight / targetHeight) % (1 << sourceChromaShift) == 0)
+		{
+			sliceGranularity = rows;
+			break;
+		}
+	}
+
+	int sliceCount = 1;
+
+	if (sliceGranularity > 0 && !(sourceDescriptor->flags & AV_PIX_FMT_FLAG_PAL))
+		sliceCount = std::max(1, std::min(threadCount, targetHeight / sliceGranularity));
+
+	int granuleCount = (sliceGranularity > 0) ? (targetHeight / sliceGranularity) : 1;
+
+	for (int i = 0; i < sliceCount; ++i)
+	{
+		Slice slice;
+
+		slice.targetY = (i == 0) ? 0 : (granuleCount * i / sliceCount) * sliceGranularity;
+		int targetEnd = (i == sliceCount - 1) ? targetHeight : (granuleCount * (i + 1) / sliceCount) * sliceGranularity;
+		slice.targetHeight = targetEnd - slice.targetY;
+		slice.sourceY = (int)((int64_t)slice.targetY * sourceHeight / targetHeight);
+		slice.sourceHeight = (int)((int64_t)targetEnd * sourceHeight / targetHeight) - slice.sourceY;
+
+		slice.swsContext = sws_getContext(sourceWidth, slice.sourceHeight, sourcePixelFormat, targetWidth, slice.targetHeight, targetPixelFormat, SWS_BILINEAR, nullptr, nullptr, nullptr);
+
+		if (!slice.swsContext)
+		{
+			qWarning("Could not get sws context");
+			return false;
+		}
+
+		slices.push_back(slice);
+	}
+
+	return true;
+}
+
+FrameConverter::~FrameConverter()
+{
+	freeSlices();
+}
+
+void FrameConverter::convert(const uint8_t* const sourceData[], const int sourceLineSize[], uint8_t* const targetData[], const int targetLineSize[])
+{
+	if (slices.empty())
+		return;
+
+	// every slice gets its own thread, the calling thread takes the first one itself
+	ParallelTaskRunner::run((int)slices.size(), (int)slices.size(), [&](int sliceIndex)
+	{
+		convertSlice(slices[(size_t)sliceIndex], sourceData, sourceLineSize, targetData, targetLineSize);
+	});
+}
+
+int FrameConverter::getSliceCount() const
+{
+	return (int)slices.size();
+}
+
+void FrameConverter::freeSlices()
+{
+	for (Slice& slice : slices)
+	{
+		if (slice.swsContext != nullptr)
+		{
+			sws_freeContext(slice.swsContext);
+			slice.swsContext = nullptr;
+		}
+	}
+
+	slices.clear();
+}
+
+void FrameConverter::convertSlice(const Slice& slice, const uint8_t* const sourceData[], const int sourceLineSize[], uint8_t* const targetData[], const int targetLineSize[])
+{
+	const uint8_t* sourceSlice[4] = { sourceData[0], sourceData[1], sourceData[2], sourceData[3] };
+	uint8_t* targetSlice[4] = { targetData[0], targetData[1], targetData[2], targetData[3] };
+
+	// extra pointers (e.g. palettes) are passed as is
+	for (int i = 0; i < 4; ++i)
+	{
+		int chromaShift = (i == 1 || i == 2) ? sourceChromaShift : 0;
+
+		if (i < sourcePlaneCount)
+			sourceSlice[i] += (ptrdiff_t)(slice.sourceY >> chromaShift) * sourceLineSize[i];
+
+		chromaShift = (i == 1 || i == 2) ? targetChromaShift : 0;
+
+		if (i < targetPlaneCount)
+			targetSlice[i] += (ptrdiff_t)(slice.targetY >> chromaShift) * targetLineSize[i];
+	}
+
+	sws_scale(slice.swsContext, sourceSlice, sourceLineSize, 0, slice.sourceHeight, targetSlice, targetLineSize);
+}
+
+void FrameConverter::runBenchmark()
+{
+	struct BenchmarkCase
+	{
+		const char* name;
+		int sourceWidth;
+		int sourceHeight;
+		AVPixelFormat sourcePixelFormat;
+		int targetWidth;
+		int targetHeight;
+		AVPixelFormat targetPixelFormat;
+	};
+
+	// the conversions done by the decoder and the encoder with 4K material
+	const BenchmarkCase benchmarkCases[] =
+	{
+		{ "decoder video", 3840, 2160, PIX_FMT_YUV420P, 3840, 2160, PIX_FMT_RGBA },
+		{ "decoder grayscale", 3840, 2160, PIX_FMT_YUV420P, 480, 270, PIX_FMT_GRAY8 },
+		{ "encoder", 3840, 2160, PIX_FMT_RGBA, 3840, 2160, PIX_FMT_YUV420P }
+	};
+
+	const int iterations = 20;
+
+	qDebug("Frame converter benchmark (%d iterations, %d cores)", iterations, QThread::idealThreadCount());
+
+	for (const BenchmarkCase& benchmarkCase : benchmarkCases)
+	{
+		AVPicture sourcePicture;
+		AVPicture targetPicture;
+
+		if (avpicture_alloc(&sourcePicture, benchmarkCase.sourcePixelFormat, benchmarkCase.sourceWidth, benchmarkCase.sourceHeight) < 0 ||
+			avpicture_alloc(&targetPicture, benchmarkCase.targetPixelFormat, benchmarkCase.targetWidth, benchmarkCase.targetHeight) < 0)
+		{
+			qWarning("Could not allocate benchmark pictures");
+			return;
+		}
+
+		int sourceDataLength = avpicture_get_size(benchmarkCase.sourcePixelFormat, benchmarkCase.sourceWidth, benchmarkCase.sourceHeight);
+
+		for (int i = 0; i < sourceDataLength; ++i)
+			sourcePicture.data[0][i] = (uint8_t)(i * 31);
+
+		double singleThreadTime = 0.0;
+
+		for (int threadCount = 1; threadCount <= QThread::idealThreadCount(); threadCount *= 2)
+		{
+			FrameConverter frameConverter;
+
+			if (!frameConverter.initialize(benchmarkCase.sourceWidth, benchmarkCase.sourceHeight, benchmarkCase.sourcePixelFormat, benchmarkCase.targetWidth, benchmarkCase.targetHeight, benchmarkCase.targetPixelFormat, threadCount))
+				break;
+
+			QElapsedTimer timer;
+			timer.start();
+
+			for (int i = 0; i < iterations; ++i)
+				frameConverter.convert(sourcePicture.data, sourcePicture.linesize, targetPicture.data, targetPicture.linesize);
+
+			double averageTime = timer.nsecsElapsed() / 1000000.0 / iterations;
+
+			if (threadCount == 1)
+				singleThreadTime = averageTime;
+
+			qDebug("%s: %d slice(s) %.2f ms (%.2fx)", benchmarkCase.name, frameConverter.getSliceCount(), averageTime, singleThreadTime / averageTime);
+		}
+
+		avpicture_free(&targetPicture);
+		avpicture_free(&sourcePicture);
+	}
+}
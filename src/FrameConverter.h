@@ -0,0 +1,52 @@
+// Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: GPLv3, see the LICENSE file.
+
+#pragma once
+
+#include <vector>
+
+extern "C"
+{
+#include "libavutil/pixfmt.h"
+#include "libswscale/swscale.h"
+}
+
+namespace OrientView
+{
+	// Scale and convert frames with sws in horizontal slices which are processed in parallel on the shared thread pool.
+	class FrameConverter
+	{
+
+	public:
+
+		bool initialize(int sourceWidth, int sourceHeight, AVPixelFormat sourcePixelFormat, int targetWidth, int targetHeight, AVPixelFormat targetPixelFormat, int threadCount);
+		~FrameConverter();
+
+		void convert(const uint8_t* const sourceData[], const int sourceLineSize[], uint8_t* const targetData[], const int targetLineSize[]);
+
+		int getSliceCount() const;
+
+		static void runBenchmark();
+
+	private:
+
+		struct Slice
+		{
+			SwsContext* swsContext = nullptr;
+			int sourceY = 0;
+			int sourceHeight = 0;
+			int targetY = 0;
+			int targetHeight = 0;
+		};
+
+		void freeSlices();
+		void convertSlice(const Slice& slice, const uint8_t* const sourceData[], const int sourceLineSize[], uint8_t* const targetData[], const int targetLineSize[]);
+
+		std::vector<Slice> slices;
+
+		int sourcePlaneCount = 0;
+		int targetPlaneCount = 0;
+		int sourceChromaShift = 0;
+		int targetChromaShift = 0;
+	};
+}
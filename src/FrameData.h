@@ -7,16 +7,29 @@
 
 namespace OrientView
 {
+	class FramePool;
+
 	// Contains the frame data that is passed around from one stage to another.
 	struct FrameData
 	{
-		uint8_t* data = nullptr;		// Raw data, format depends on context (RGBA32 or GRAY8)
+		uint8_t* data = nullptr;		// Raw data, format depends on context (RGBA32, GRAY8 or planar YUV)
 		size_t dataLength = 0;			// Data length in bytes
 		size_t rowLength = 0;			// Length of the row in bytes (could be larger than width)
 		int width = 0;					// Width in pixels
 		int height = 0;					// Height in pixels
+		size_t chromaRowLength = 0;		// Length of the U and V plane rows in bytes (planar YUV only, planes follow the Y plane)
+		int chromaWidth = 0;			// Width of the U and V planes in pixels (planar YUV only)
+		int chromaHeight = 0;			// Height of the U and V planes in pixels (planar YUV only)
 		int64_t duration = 0;			// Duration in microseconds
 		int64_t timeStamp = 0;			// Time stamp given by FFmpeg (no unit)
 		int64_t cumulativeNumber = 0;	// Total number of frames produced (doesn't reset on seek)
+		double time = 0.0;				// Presentation time in seconds
+		bool hasMotion = false;			// The motion from the previous frame was estimated by the decoder (motion vector stabilization)
+		double motionX = 0.0;			// Horizontal motion relative to the frame width
+		double motionY = 0.0;			// Vertical motion relative to the frame height
+		double motionAngle = 0.0;		// Rotation in degrees
+		bool hasNextMotion = false;		// The decoder expects the next frame to have the motion as well (motion vector stabilization)
+		FramePool* pool = nullptr;		// Pool owning the data (null if owned by the producer)
+		int poolIndex = -1;				// Index of the data buffer inside the pool
 	};
 }
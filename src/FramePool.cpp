@@ -0,0 +1,115 @@
+// Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: GPLv3, see the LICENSE file.
+
+#include <new>
+
+#include "FramePool.h"
+#include "FrameData.h"
+
+using namespace OrientView;
+
+bool FramePool::initialize(int frameCount, size_t frameDataLength)
+{
+	if (frameCount <= 0)
+	{
+		qWarning("Frame pool needs at least one frame");
+		return false;
+	}
+
+	this->frameDataLength = frameDataLength;
+
+	for (int i = 0; i < frameCount; ++i)
+	{
+		uint8_t* frameBuffer = new (std::nothrow) uint8_t[frameDataLength > 0 ? frameDataLength : 1];
+
+		if (frameBuffer == nullptr)
+		{
+			qWarning("Could not allocate %d frames of %.1f MB for the frame pool", frameCount, frameDataLength / (1024.0 * 1024.0));
+			return false;
+		}
+
+		frameBuffers.push_back(frameBuffer);
+		referenceCounts.push_back(0);
+		freeFrameIndices.push_back(i);
+	}
+
+	freeFrameSemaphore.release(frameCount);
+
+	return true;
+}
+
+FramePool::~FramePool()
+{
+	for (uint8_t* frameBuffer : frameBuffers)
+		delete[] frameBuffer;
+
+	frameBuffers.clear();
+}
+
+bool FramePool::tryAcquireFrame(FrameData& frameData, int timeout)
+{
+	if (!freeFrameSemaphore.tryAcquire(1, timeout))
+		return false;
+
+	QMutexLocker locker(&poolMutex);
+
+	int index = freeFrameIndices.back();
+	freeFrameIndices.pop_back();
+	referenceCounts[(size_t)index] = 1;
+
+	frameData = FrameData();
+	frameData.data = frameBuffers[(size_t)index];
+	frameData.dataLength = frameDataLength;
+	frameData.pool = this;
+	frameData.poolIndex = index;
+
+	return true;
+}
+
+void FramePool::retainFrame(const FrameData& frameData)
+{
+	if (frameData.pool != this || frameData.poolIndex < 0)
+		return;
+
+	QMutexLocker locker(&poolMutex);
+
+	referenceCounts[(size_t)frameData.poolIndex]++;
+}
+
+void FramePool::releaseFrame(FrameData& frameData)
+{
+	if (frameData.pool != this || frameData.poolIndex < 0)
+		return;
+
+	{
+		QMutexLocker locker(&poolMutex);
+
+		int& referenceCount = referenceCounts[(size_t)frameData.poolIndex];
+
+		if (--referenceCount > 0)
+		{
+			frameData = FrameData();
+			return;
+		}
+
+		freeFrameIndices.push_back(frameData.poolIndex);
+	}
+
+	frameData = FrameData();
+	freeFrameSemaphore.release(1);
+}
+
+int FramePool::getFrameCount() const
+{
+	return (int)frameBuffers.size();
+}
+
+int FramePool::getFreeFrameCount() const
+{
+	return freeFrameSemaphore.available();
+}
+
+size_t FramePool::getFrameDataLength() const
+{
+	return frameDataLength;
+}
@@ -0,0 +1,44 @@
+// Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: GPLv3, see the LICENSE file.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <QMutex>
+#include <QSemaphore>
+
+namespace OrientView
+{
+	struct FrameData;
+
+	// Preallocated set of reference counted frame buffers shared between the pipeline stages.
+	class FramePool
+	{
+
+	public:
+
+		bool initialize(int frameCount, size_t frameDataLength);
+		~FramePool();
+
+		bool tryAcquireFrame(FrameData& frameData, int timeout);
+		void retainFrame(const FrameData& frameData);
+		void releaseFrame(FrameData& frameData);
+
+		int getFrameCount() const;
+		int getFreeFrameCount() const;
+		size_t getFrameDataLength() const;
+
+	private:
+
+		QMutex poolMutex;
+		QSemaphore freeFrameSemaphore;
+
+		std::vector<uint8_t*> frameBuffers;
+		std::vector<int> referenceCounts;
+		std::vector<int> freeFrameIndices;
+
+		size_t frameDataLength = 0;
+	};
+}
@@ -0,0 +1,172 @@
+// Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: GPLv3, see the LICENSE file.
+
+#include <algorithm>
+#include <cmath>
+
+#include "FramePositionSmoother.h"
+
+using namespace OrientView;
+
+void FramePositionSmoother::initialize(const FramePosition* framePositions, size_t framePositionCount, StabilizerSmoothingType type, int smoothingRadius)
+{
+	this->framePositions = framePositions;
+	this->framePositionCount = framePositionCount;
+	this->type = type;
+	this->smoothingRadius = (size_t)std::max(0, smoothingRadius);
+
+	nextIndex = 0;
+	windowStart = 0;
+	windowEnd = 0;
+	sumX = 0.0;
+	sumY = 0.0;
+	sumAngle = 0.0;
+
+	forwardAverages.clear();
+	gaussianAverages.clear();
+	forwardStart = 0;
+	forwardEnd = 0;
+	gaussianBlockStart = 0;
+	gaussianBlockEnd = 0;
+
+	// same spread as the window average of the same radius
+	double sigma = smoothingRadius / sqrt(3.0);
+
+	if (type == StabilizerSmoothingType::RecursiveGaussian && sigma >= 0.5 && framePositionCount > 0)
+		initializeGaussian(sigma);
+	else
+		this->type = StabilizerSmoothingType::WindowAverage;
+}
+
+// Returns the smoothed position of the next frame, the frames are gone through in order.
+FramePosition FramePositionSmoother::getNextAverage()
+{
+	FramePosition average;
+
+	if (nextIndex >= framePositionCount)
+		return average;
+
+	size_t index = nextIndex++;
+
+	average.timeStamp = framePositions[index].timeStamp;
+
+	if (type == StabilizerSmoothingType::RecursiveGaussian)
+	{
+		if (index >= gaussianBlockEnd)
+			filterGaussianBlock(index);
+
+		const FramePosition& gaussianAverage = gaussianAverages[index - gaussianBlockStart];
+
+		average.x = gaussianAverage.x;
+		average.y = gaussianAverage.y;
+		average.angle = gaussianAverage.angle;
+
+		return average;
+	}
+
+	// the window is cut short at the ends of the video
+	size_t targetWindowEnd = std::min(framePositionCount, index + smoothingRadius + 1);
+	size_t targetWindowStart = (index > smoothingRadius) ? (index - smoothingRadius) : 0;
+
+	for (; windowEnd < targetWindowEnd; ++windowEnd)
+	{
+		sumX += framePositions[windowEnd].x;
+		sumY += framePositions[windowEnd].y;
+		sumAngle += framePositions[windowEnd].angle;
+	}
+
+	for (; windowStart < targetWindowStart; ++windowStart)
+	{
+		sumX -= framePositions[windowStart].x;
+		sumY -= framePositions[windowStart].y;
+		sumAngle -= framePositions[windowStart].angle;
+	}
+
+	double windowSize = (double)(windowEnd - windowStart);
+
+	average.x = sumX / windowSize;
+	average.y = sumY / windowSize;
+	average.angle = sumAngle / windowSize;
+
+	return average;
+}
+
+void FramePositionSmoother::initializeGaussian(double sigma)
+{
+	double q;
+
+	if (sigma >= 2.5)
+		q = 0.98711 * sigma - 0.96330;
+	else
+		q = 3.97156 - 4.14554 * sqrt(1.0 - 0.26891 * sigma);
+
+	double q2 = q * q;
+	double q3 = q2 * q;
+
+	double b0 = 1.57825 + 2.44413 * q + 1.4281 * q2 + 0.422205 * q3;
+	gaussianB1 = (2.44413 * q + 2.85619 * q2 + 1.26661 * q3) / b0;
+	gaussianB2 = -(1.4281 * q2 + 1.26661 * q3) / b0;
+	gaussianB3 = (0.422205 * q3) / b0;
+	gaussianB = 1.0 - (gaussianB1 + gaussianB2 + gaussianB3);
+
+	// the response of the backward pass has died down to nothing within sixteen sigmas
+	gaussianTailLength = (size_t)(16.0 * sigma) + 16;
+
+	// the ends are extended with the first and the last positions
+	forwardW1 = framePositions[0];
+	forwardW2 = forwardW1;
+	forwardW3 = forwardW1;
+}
+
+// Runs the filter forward up to a tail after the block and then backward from there, which cancels out the delay of the recursion.
+// The backward pass starts from the forward values at the end of the tail, which is exact at the end of the video and has faded out by the block elsewhere.
+void FramePositionSmoother::filterGaussianBlock(size_t blockStart)
+{
+	size_t blockEnd = std::min(framePositionCount, blockStart + gaussianTailLength);
+	size_t filterEnd = std::min(framePositionCount, blockEnd + gaussianTailLength);
+
+	// the forward values before the block are not needed anymore
+	forwardAverages.erase(forwardAverages.begin(), forwardAverages.begin() + (blockStart - forwardStart));
+	forwardStart = blockStart;
+
+	for (; forwardEnd < filterEnd; ++forwardEnd)
+	{
+		FramePosition w;
+
+		w.x = gaussianB * framePositions[forwardEnd].x + gaussianB1 * forwardW1.x + gaussianB2 * forwardW2.x + gaussianB3 * forwardW3.x;
+		w.y = gaussianB * framePositions[forwardEnd].y + gaussianB1 * forwardW1.y + gaussianB2 * forwardW2.y + gaussianB3 * forwardW3.y;
+		w.angle = gaussianB * framePositions[forwardEnd].angle + gaussianB1 * forwardW1.angle + gaussianB2 * forwardW2.angle + gaussianB3 * forwardW3.angle;
+
+		forwardAverages.push_back(w);
+
+		forwardW3 = forwardW2;
+		forwardW2 = forwardW1;
+		forwardW1 = w;
+	}
+
+	gaussianAverages.resize(blockEnd - blockStart);
+
+	FramePosition w1 = forwardAverages[filterEnd - 1 - forwardStart];
+	FramePosition w2 = w1;
+	FramePosition w3 = w1;
+
+	for (size_t i = filterEnd; i-- > blockStart;)
+	{
+		const FramePosition& w = forwardAverages[i - forwardStart];
+		FramePosition y;
+
+		y.x = gaussianB * w.x + gaussianB1 * w1.x + gaussianB2 * w2.x + gaussianB3 * w3.x;
+		y.y = gaussianB * w.y + gaussianB1 * w1.y + gaussianB2 * w2.y + gaussianB3 * w3.y;
+		y.angle = gaussianB * w.angle + gaussianB1 * w1.angle + gaussianB2 * w2.angle + gaussianB3 * w3.angle;
+
+		if (i < blockEnd)
+			gaussianAverages[i - blockStart] = y;
+
+		w3 = w2;
+		w2 = w1;
+		w1 = y;
+	}
+
+	gaussianBlockStart = blockStart;
+	gaussianBlockEnd = blockEnd;
+}
@@ -0,0 +1,57 @@
+// Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: GPLv3, see the LICENSE file.
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "VideoStabilizer.h"
+
+namespace OrientView
+{
+	// Smooth the cumulative frame positions in one pass over them, the time does not depend on the smoothing radius.
+	// The window average keeps running sums over a window sliding along the positions, the Gaussian is the recursive Young-van Vliet filter.
+	// Neither keeps a copy of all the positions, the backward pass of the Gaussian is run in blocks starting a fading tail after each block.
+	class FramePositionSmoother
+	{
+
+	public:
+
+		void initialize(const FramePosition* framePositions, size_t framePositionCount, StabilizerSmoothingType type, int smoothingRadius);
+
+		FramePosition getNextAverage();
+
+	private:
+
+		void initializeGaussian(double sigma);
+		void filterGaussianBlock(size_t blockStart);
+
+		const FramePosition* framePositions = nullptr;
+		size_t framePositionCount = 0;
+		StabilizerSmoothingType type = StabilizerSmoothingType::WindowAverage;
+		size_t smoothingRadius = 0;
+
+		size_t nextIndex = 0;
+		size_t windowStart = 0;
+		size_t windowEnd = 0; // exclusive
+		double sumX = 0.0;
+		double sumY = 0.0;
+		double sumAngle = 0.0;
+
+		double gaussianB = 0.0;
+		double gaussianB1 = 0.0;
+		double gaussianB2 = 0.0;
+		double gaussianB3 = 0.0;
+		size_t gaussianTailLength = 0; // the backward pass has faded out this far from its start
+		FramePosition forwardW1; // the state of the forward pass
+		FramePosition forwardW2;
+		FramePosition forwardW3;
+		size_t forwardStart = 0;
+		size_t forwardEnd = 0; // exclusive
+		std::vector<FramePosition> forwardAverages; // from the forward start to the forward end
+		size_t gaussianBlockStart = 0;
+		size_t gaussianBlockEnd = 0; // exclusive
+		std::vector<FramePosition> gaussianAverages; // from the block start to the block end
+	};
+}
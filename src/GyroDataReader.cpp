@@ -0,0 +1,432 @@
+// Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: GPLv3, see the LICENSE file.
+
+#define _USE_MATH_DEFINES
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <QFile>
+#include <QStringList>
+
+extern "C"
+{
+#include "libavformat/avformat.h"
+}
+
+#include "GyroDataReader.h"
+
+using namespace OrientView;
+
+namespace
+{
+	// the axis order of the HERO5 cameras, the later ones tell it in the ORIN key
+	const char* defaultOrientation = "ZXY";
+
+	// the cameras write one payload a second
+	const double rawPacketDuration = 1.0;
+
+	// GPMF is a list of 8 byte key-type-size-repeat headers, each followed by its data padded to four bytes
+	struct KlvHeader
+	{
+		char key[4];
+		char type;
+		uint8_t structSize;
+		uint16_t repeat;
+	};
+
+	bool readKlvHeader(const uint8_t* data, size_t size, size_t offset, KlvHeader& header, size_t& dataSize)
+	{
+		if (offset + 8 > size)
+			return false;
+
+		memcpy(header.key, data + offset, 4);
+		header.type = (char)data[offset + 4];
+		header.structSize = data[offset + 5];
+		header.repeat = (uint16_t)((data[offset + 6] << 8) | data[offset + 7]);
+
+		dataSize = (size_t)header.structSize * header.repeat;
+
+		return (offset + 8 + dataSize <= size);
+	}
+
+	bool isKey(const KlvHeader& header, const char* key)
+	{
+		return (memcmp(header.key, key, 4) == 0);
+	}
+
+	size_t getTypeSize(char type)
+	{
+		switch (type)
+		{
+			case 'b': case 'B': case 'c': return 1;
+			case 's': case 'S': return 2;
+			case 'l': case 'L': case 'f': return 4;
+			case 'd': case 'j': case 'J': return 8;
+			default: return 0;
+		}
+	}
+
+	// the values are big endian
+	double readValue(const uint8_t* data, char type)
+	{
+		uint64_t bits = 0;
+
+		for (size_t i = 0; i < getTypeSize(type); ++i)
+			bits = (bits << 8) | data[i];
+
+		switch (type)
+		{
+			case 'b': return (double)(int8_t)bits;
+			case 'B': return (double)(uint8_t)bits;
+			case 's': return (double)(int16_t)bits;
+			case 'S': return (double)(uint16_t)bits;
+			case 'l': return (double)(int32_t)bits;
+			case 'L': return (double)(uint32_t)bits;
+			case 'j': return (double)(int64_t)bits;
+			case 'J': return (double)bits;
+			case 'f': { uint32_t value = (uint32_t)bits; float result; memcpy(&result, &value, 4); return (double)result; }
+			case 'd': { double result; memcpy(&result, &bits, 8); return result; }
+			default: return 0.0;
+		}
+	}
+}
+
+bool GyroDataReader::initialize(const QString& fileNames, const QString& orientation)
+{
+	qDebug("Initializing GyroDataReader (%s)", qPrintable(fileNames));
+
+	this->orientation = orientation;
+
+	av_register_all();
+
+	packets.clear();
+	gyroSamples.clear();
+	duration = 0.0;
+
+	for (const QString& fileName : fileNames.split('|', QString::SkipEmptyParts))
+	{
+		double fileDuration = 0.0;
+		QString trimmedFileName = fileName.trimmed();
+
+		if (trimmedFileName.endsWith(".gpmf", Qt::CaseInsensitive))
+		{
+			if (!readRawFile(trimmedFileName, duration, fileDuration))
+				return false;
+		}
+		else if (!readFile(trimmedFileName, duration, fileDuration))
+			return false;
+
+		duration += fileDuration;
+	}
+
+	// the samples of a packet are spread evenly over the time it covers
+	for (size_t i = 0; i < packets.size(); ++i)
+	{
+		Packet& packet = packets[i];
+		double endTime = packet.endTime;
+
+		if (endTime <= packet.startTime)
+			endTime = (i + 1 < packets.size()) ? packets[i + 1].startTime : packet.startTime + 1.0;
+
+		double sampleDuration = (endTime - packet.startTime) / std::max((size_t)1, packet.samples.size());
+
+		for (size_t j = 0; j < packet.samples.size(); ++j)
+		{
+			GyroSample sample = packet.samples[j];
+			sample.time = packet.startTime + j * sampleDuration;
+			gyroSamples.push_back(sample);
+		}
+	}
+
+	packets.clear();
+
+	if (gyroSamples.size() < 2)
+	{
+		qWarning("Could not find the gyro data");
+		return false;
+	}
+
+	qDebug("Read %d gyro samples (%.1f Hz)", (int)gyroSamples.size(), getSampleRate());
+
+	return true;
+}
+
+bool GyroDataReader::readFile(const QString& fileName, double timeOffset, double& fileDuration)
+{
+	AVFormatContext* formatContext = nullptr;
+
+	if (avformat_open_input(&formatContext, fileName.toUtf8().constData(), nullptr, nullptr) < 0)
+	{
+		qWarning("Could not open source file");
+		return false;
+	}
+
+	if (avformat_find_stream_info(formatContext, nullptr) < 0)
+	{
+		qWarning("Could not find stream information");
+		avformat_close_input(&formatContext);
+		return false;
+	}
+
+	int videoStreamIndex = av_find_best_stream(formatContext, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+	int dataStreamIndex = -1;
+
+	for (unsigned int i = 0; i < formatContext->nb_streams; ++i)
+	{
+		AVStream* stream = formatContext->streams[i];
+		AVDictionaryEntry* handlerName = av_dict_get(stream->metadata, "handler_name", nullptr, 0);
+
+		if (dataStreamIndex < 0 && (stream->codec->codec_tag == MKTAG('g', 'p', 'm', 'd') || (handlerName != nullptr && strstr(handlerName->value, "GoPro MET") != nullptr)))
+			dataStreamIndex = (int)i;
+		else
+			stream->discard = AVDISCARD_ALL;
+	}
+
+	if (videoStreamIndex < 0 || dataStreamIndex < 0)
+	{
+		qWarning("Could not find the gyro data stream in %s", qPrintable(fileName));
+		avformat_close_input(&formatContext);
+		return false;
+	}
+
+	AVStream* videoStream = formatContext->streams[(size_t)videoStreamIndex];
+	AVStream* dataStream = formatContext->streams[(size_t)dataStreamIndex];
+
+	if (frameRate <= 0.0)
+	{
+		AVRational rate = (videoStream->avg_frame_rate.num > 0) ? videoStream->avg_frame_rate : videoStream->r_frame_rate;
+
+		frameRate = (rate.den > 0) ? av_q2d(rate) : 0.0;
+		frameWidth = videoStream->codec->width;
+		frameHeight = videoStream->codec->height;
+	}
+
+	// the times are relative to the start of the video
+	double videoStartTime = (videoStream->start_time != AV_NOPTS_VALUE) ? videoStream->start_time * av_q2d(videoStream->time_base) : 0.0;
+	double dataTimeBase = av_q2d(dataStream->time_base);
+
+	if (videoStream->duration != AV_NOPTS_VALUE)
+		fileDuration = videoStream->duration * av_q2d(videoStream->time_base);
+	else
+		fileDuration = (formatContext->duration != AV_NOPTS_VALUE) ? (double)formatContext->duration / AV_TIME_BASE : 0.0;
+
+	AVPacket packet;
+	av_init_packet(&packet);
+	packet.data = nullptr;
+	packet.size = 0;
+
+	while (av_read_frame(formatContext, &packet) >= 0)
+	{
+		if (packet.stream_index == dataStreamIndex)
+		{
+			int64_t timestamp = (packet.pts != AV_NOPTS_VALUE) ? packet.pts : packet.dts;
+
+			Packet gyroPacket;
+			gyroPacket.startTime = ((timestamp != AV_NOPTS_VALUE) ? timestamp * dataTimeBase - videoStartTime : 0.0) + timeOffset;
+
+			if (packet.duration > 0)
+				gyroPacket.endTime = gyroPacket.startTime + packet.duration * dataTimeBase;
+
+			parseContainer(packet.data, (size_t)packet.size, gyroPacket);
+
+			if (!gyroPacket.samples.empty())
+				packets.push_back(gyroPacket);
+		}
+
+		av_free_packet(&packet);
+	}
+
+	avformat_close_input(&formatContext);
+
+	return true;
+}
+
+// The raw payloads have no video, so the frame rate and the size are left unknown.
+bool GyroDataReader::readRawFile(const QString& fileName, double timeOffset, double& fileDuration)
+{
+	QFile file(fileName);
+
+	if (!file.open(QIODevice::ReadOnly))
+	{
+		qWarning("Could not open gyro data file: %s", qPrintable(file.errorString()));
+		return false;
+	}
+
+	QByteArray data = file.readAll();
+
+	Packet gyroPacket;
+	gyroPacket.startTime = timeOffset;
+	gyroPacket.endTime = timeOffset + rawPacketDuration;
+
+	parseContainer((const uint8_t*)data.constData(), (size_t)data.size(), gyroPacket);
+
+	if (!gyroPacket.samples.empty())
+		packets.push_back(gyroPacket);
+
+	fileDuration = rawPacketDuration;
+
+	return true;
+}
+
+// The device containers hold the streams of the different sensors.
+void GyroDataReader::parseContainer(const uint8_t* data, size_t size, Packet& packet)
+{
+	KlvHeader header;
+	size_t dataSize = 0;
+
+	for (size_t offset = 0; readKlvHeader(data, size, offset, header, dataSize); offset += 8 + ((dataSize + 3) & ~(size_t)3))
+	{
+		if (header.type != 0)
+			continue;
+
+		const uint8_t* nestedData = data + offset + 8;
+
+		if (isKey(header, "DEVC"))
+			parseContainer(nestedData, dataSize, packet);
+		else if (isKey(header, "STRM"))
+			parseStream(nestedData, dataSize, packet);
+	}
+}
+
+// The scales and the orientation come before the samples in the stream.
+void GyroDataReader::parseStream(const uint8_t* data, size_t size, Packet& packet)
+{
+	KlvHeader header;
+	size_t dataSize = 0;
+
+	double scale[3] = { 1.0, 1.0, 1.0 };
+	QString streamOrientation = defaultOrientation;
+
+	for (size_t offset = 0; readKlvHeader(data, size, offset, header, dataSize); offset += 8 + ((dataSize + 3) & ~(size_t)3))
+	{
+		const uint8_t* valueData = data + offset + 8;
+		size_t typeSize = getTypeSize(header.type);
+
+		if (typeSize == 0)
+			continue;
+
+		if (isKey(header, "SCAL"))
+		{
+			size_t count = dataSize / typeSize;
+
+			// an empty scale leaves the previous ones in place
+			if (count == 0)
+				continue;
+
+			for (size_t i = 0; i < 3; ++i)
+				scale[i] = readValue(valueData + std::min(i, count - 1) * typeSize, header.type);
+
+			continue;
+		}
+
+		if (isKey(header, "ORIN") && header.type == 'c' && dataSize >= 3)
+		{
+			streamOrientation = QString::fromLatin1((const char*)valueData, 3);
+			continue;
+		}
+
+		if (!isKey(header, "GYRO") || header.structSize < 3 * typeSize)
+			continue;
+
+		QString axes = orientation.isEmpty() ? streamOrientation : orientation;
+
+		if (axes.length() != 3)
+			axes = defaultOrientation;
+
+		for (size_t i = 0; i < header.repeat; ++i)
+		{
+			GyroSample sample;
+			double* cameraAxes[3] = { &sample.x, &sample.y, &sample.z };
+
+			// the letter tells the camera axis of the channel, lower case means the opposite direction
+			for (int j = 0; j < 3; ++j)
+			{
+				double value = readValue(valueData + i * header.structSize + j * typeSize, header.type);
+				QChar axis = axes[j];
+				int axisIndex = axis.toUpper().toLatin1() - 'X';
+
+				if (axisIndex < 0 || axisIndex > 2 || scale[j] == 0.0)
+					continue;
+
+				*cameraAxes[axisIndex] = (axis.isLower() ? -value : value) / scale[j];
+			}
+
+			packet.samples.push_back(sample);
+		}
+	}
+}
+
+const std::vector<GyroSample>& GyroDataReader::getGyroSamples() const
+{
+	return gyroSamples;
+}
+
+// The rotation in radians from the first sample to each sample time, integrated with the trapezoid rule.
+std::vector<GyroSample> GyroDataReader::getGyroAngles() const
+{
+	std::vector<GyroSample> angles(gyroSamples.size());
+
+	for (size_t i = 1; i < gyroSamples.size(); ++i)
+	{
+		double timeStep = gyroSamples[i].time - gyroSamples[i - 1].time;
+
+		angles[i].time = gyroSamples[i].time;
+		angles[i].x = angles[i - 1].x + 0.5 * (gyroSamples[i - 1].x + gyroSamples[i].x) * timeStep;
+		angles[i].y = angles[i - 1].y + 0.5 * (gyroSamples[i - 1].y + gyroSamples[i].y) * timeStep;
+		angles[i].z = angles[i - 1].z + 0.5 * (gyroSamples[i - 1].z + gyroSamples[i].z) * timeStep;
+	}
+
+	if (!angles.empty())
+		angles[0].time = gyroSamples[0].time;
+
+	return angles;
+}
+
+double GyroDataReader::getSampleRate() const
+{
+	if (gyroSamples.size() < 2 || gyroSamples.back().time <= gyroSamples.front().time)
+		return 0.0;
+
+	return (gyroSamples.size() - 1) / (gyroSamples.back().time - gyroSamples.front().time);
+}
+
+double GyroDataReader::getFrameRate() const
+{
+	return frameRate;
+}
+
+double GyroDataReader::getDuration() const
+{
+	return duration;
+}
+
+int GyroDataReader::getFrameWidth() const
+{
+	return frameWidth;
+}
+
+int GyroDataReader::getFrameHeight() const
+{
+	return frameHeight;
+}
+
+// Logs what was read from the telemetry, so that the parsing can be checked against known data.
+void GyroDataReader::runDump(const QString& fileNames)
+{
+	GyroDataReader gyroDataReader;
+
+	if (!gyroDataReader.initialize(fileNames, ""))
+		return;
+
+	const std::vector<GyroSample>& samples = gyroDataReader.getGyroSamples();
+	GyroSample angle = gyroDataReader.getGyroAngles().back();
+
+	qDebug("Gyro data dump (%s)", qPrintable(fileNames));
+	qDebug("Samples: %d from %.3f s to %.3f s", (int)samples.size(), samples.front().time, samples.back().time);
+	qDebug("Sample rate: %.1f Hz", gyroDataReader.getSampleRate());
+	qDebug("Integrated angles: x %.4f y %.4f z %.4f degrees", angle.x * 180.0 / M_PI, angle.y * 180.0 / M_PI, angle.z * 180.0 / M_PI);
+
+	if (gyroDataReader.getFrameRate() > 0.0)
+		qDebug("Video: %dx%d %.3f fps %.3f s", gyroDataReader.getFrameWidth(), gyroDataReader.getFrameHeight(), gyroDataReader.getFrameRate(), gyroDataReader.getDuration());
+}
@@ -0,0 +1,66 @@
+// Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: GPLv3, see the LICENSE file.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <QString>
+
+namespace OrientView
+{
+	// Angular velocity in radians per second around the camera axes: x points right, y down and z forward along the lens.
+	struct GyroSample
+	{
+		double time = 0.0; // seconds from the start of the video
+		double x = 0.0;
+		double y = 0.0;
+		double z = 0.0;
+	};
+
+	// Read the gyroscope telemetry (GPMF) that GoPro cameras store as a data track in the video files.
+	// Parts of a split recording are given separated by | like for the video decoder and are placed one after another.
+	// A .gpmf file is read as a single raw telemetry payload of one second, like the ones in the data track.
+	class GyroDataReader
+	{
+
+	public:
+
+		bool initialize(const QString& fileNames, const QString& orientation);
+
+		const std::vector<GyroSample>& getGyroSamples() const;
+		std::vector<GyroSample> getGyroAngles() const;
+		double getSampleRate() const;
+		double getFrameRate() const;
+		double getDuration() const;
+		int getFrameWidth() const;
+		int getFrameHeight() const;
+
+		static void runDump(const QString& fileNames);
+
+	private:
+
+		struct Packet
+		{
+			double startTime = 0.0;
+			double endTime = -1.0; // not known if negative
+			std::vector<GyroSample> samples; // without the times
+		};
+
+		bool readFile(const QString& fileName, double timeOffset, double& fileDuration);
+		bool readRawFile(const QString& fileName, double timeOffset, double& fileDuration);
+		void parseContainer(const uint8_t* data, size_t size, Packet& packet);
+		void parseStream(const uint8_t* data, size_t size, Packet& packet);
+
+		QString orientation; // forced axis mapping, empty if read from the file
+		std::vector<Packet> packets;
+		std::vector<GyroSample> gyroSamples;
+
+		double frameRate = 0.0;
+		double duration = 0.0;
+		int frameWidth = 0;
+		int frameHeight = 0;
+	};
+}
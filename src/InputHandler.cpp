@@ -87,7 +87,10 @@ void InputHandler::handleInput(double frameTime)
 		defaultRoute.showControls = !defaultRoute.showControls;
 
 	if (videoWindow->keyIsDownOnce(Qt::Key_F7))
+	{
 		videoStabilizer->toggleEnabled();
+		videoDecoderThread->setIsGrayscaleRequested(videoStabilizer->getIsGrayscaleRequested());
+	}
 
 	if (!videoWindow->keyIsDown(Qt::Key_Control) && videoWindow->keyIsDownOnce(Qt::Key_Space))
 		renderOnScreenThread->togglePaused();
@@ -96,7 +99,14 @@ void InputHandler::handleInput(double frameTime)
 		if (!renderOnScreenThread->getIsPaused())
 			renderOnScreenThread->togglePaused();
 
-		renderOnScreenThread->advanceOneFrame();
+		if (videoWindow->keyIsDown(Qt::Key_Shift))
+		{
+			renderOnScreenThread->stepBackOneFrame();
+			videoStabilizer->reset();
+		}
+		else
+			renderOnScreenThread->advanceOneFrame();
+
 		videoWindow->keyIsDownOnce(Qt::Key_Space); // clear key state
 	}
 
@@ -150,16 +160,14 @@ void InputHandler::handleInput(double frameTime)
 	{
 		if (keyIsDownWithRepeat(Qt::Key_Left, seekBackwardRepeatHandler))
 		{
-			videoDecoder->seekRelative(-seekAmount);
-			videoDecoderThread->signalFrameRead();
+			videoDecoderThread->seekRelative(-seekAmount);
 			renderOnScreenThread->advanceOneFrame();
 			videoStabilizer->reset();
 		}
 
 		if (keyIsDownWithRepeat(Qt::Key_Right, seekForwardRepeatHandler))
 		{
-			videoDecoder->seekRelative(seekAmount);
-			videoDecoderThread->signalFrameRead();
+			videoDecoderThread->seekRelative(seekAmount);
 			renderOnScreenThread->advanceOneFrame();
 			videoStabilizer->reset();
 		}
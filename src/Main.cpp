@@ -9,6 +9,10 @@
 
 #include "MainWindow.h"
 #include "SimpleLogger.h"
+#include "FrameConverter.h"
+#include "BoxDownscaler.h"
+#include "VideoStabilizer.h"
+#include "GyroDataReader.h"
 
 namespace
 {
@@ -41,6 +45,23 @@ int main(int argc, char *argv[])
 		QFontDatabase::addApplicationFont("data/fonts/dejavu-sans-mono.ttf");
 		QFontDatabase::addApplicationFont("data/fonts/dejavu-sans-mono-bold.ttf");
 
+		if (argc >= 2 && QString(argv[1]) == "--benchmark")
+		{
+			OrientView::FrameConverter::runBenchmark();
+			OrientView::BoxDownscaler::runBenchmark();
+
+			if (argc >= 3)
+				OrientView::VideoStabilizer::runBenchmark(QString(argv[2]));
+
+			return 0;
+		}
+
+		if (argc >= 3 && QString(argv[1]) == "--gyro-dump")
+		{
+			OrientView::GyroDataReader::runDump(QString(argv[2]));
+			return 0;
+		}
+
 		OrientView::MainWindow mainWindow;
 
 		logger.setMainWindow(&mainWindow);
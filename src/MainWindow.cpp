@@ -1,6 +1,7 @@
 // Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
 // License: GPLv3, see the LICENSE file.
 
+#include <algorithm>
 #include <stdexcept>
 
 #include <QFileDialog>
@@ -159,7 +160,7 @@ void MainWindow::on_actionPlayVideo_triggered()
 	{
 		videoDecoder = new VideoDecoder();
 
-		if (!videoDecoder->initialize(settings))
+		if (!videoDecoder->initialize(settings, VideoDecoderProfile::FullQuality))
 		{
 			if (QMessageBox::warning(this, "OrientView - Warning", QString("Could not open the video file.\n\nDo you want to continue anyway?"), QMessageBox::Yes | QMessageBox::No) == QMessageBox::No)
 				throw std::runtime_error("Could not initialize video decoder");
@@ -216,7 +217,12 @@ void MainWindow::on_actionPlayVideo_triggered()
 		inputHandler->initialize(videoWindow, renderer, videoDecoder, videoDecoderThread, videoStabilizer, routeManager, renderOnScreenThread, settings);
 		splitTimeManager->initialize(settings);
 		routeManager->initialize(quickRouteReader, splitTimeManager, renderer, settings);
-		videoDecoderThread->initialize(videoDecoder);
+
+		if (!videoDecoderThread->initialize(videoDecoder, settings, settings->video.frameCacheSize, 0))
+			throw std::runtime_error("Could not initialize video decoder thread");
+
+		videoDecoderThread->setIsGrayscaleRequested(videoStabilizer->getIsGrayscaleRequested());
+
 		renderOnScreenThread->initialize(this, videoWindow, videoDecoder, videoDecoderThread, videoStabilizer, routeManager, renderer, inputHandler);
 
 		connect(videoWindow, &VideoWindow::closing, this, &MainWindow::playVideoFinished);
@@ -335,7 +341,7 @@ void MainWindow::on_actionEncodeVideo_triggered()
 	{
 		videoDecoder = new VideoDecoder();
 
-		if (!videoDecoder->initialize(settings))
+		if (!videoDecoder->initialize(settings, VideoDecoderProfile::FullQuality))
 		{
 			if (QMessageBox::warning(this, "OrientView - Warning", QString("Could not open the video file.\n\nDo you want to continue anyway?"), QMessageBox::Yes | QMessageBox::No) == QMessageBox::No)
 				throw std::runtime_error("Could not initialize video decoder");
@@ -394,9 +400,28 @@ void MainWindow::on_actionEncodeVideo_triggered()
 
 		splitTimeManager->initialize(settings);
 		routeManager->initialize(quickRouteReader, splitTimeManager, renderer, settings);
-		videoDecoderThread->initialize(videoDecoder);
-		renderOffScreenThread->initialize(this, encodeWindow, videoDecoder, videoDecoderThread, videoStabilizer, routeManager, renderer, videoEncoder);
-		videoEncoderThread->initialize(videoDecoder, videoEncoder, renderOffScreenThread);
+
+		// the lookahead holds back whole decoded frames, so a large smoothing radius with a large video could take all the memory
+		int lookaheadFrameCount = videoStabilizer->getLookaheadFrameCount();
+		double frameSize = (videoDecoder->getFrameDataLength() + videoDecoder->getGrayscaleFrameDataLength()) / (1024.0 * 1024.0);
+		int maxLookaheadFrameCount = (frameSize > 0.0) ? (int)(std::max(0, settings->video.lookaheadMemorySize) / frameSize) : lookaheadFrameCount;
+
+		if (lookaheadFrameCount > maxLookaheadFrameCount)
+		{
+			qWarning("Lookahead stabilization needs %d frames (%.0f MB), the lookahead memory size allows %d", lookaheadFrameCount, lookaheadFrameCount * frameSize, maxLookaheadFrameCount);
+			throw std::runtime_error(QString("The lookahead stabilization needs %1 MB for the smoothing radius of %2 frames, which is more than the lookahead memory size of %3 MB. Lower the smoothing radius or raise video/lookaheadMemorySize in the settings file").arg((int)(lookaheadFrameCount * frameSize + 0.5)).arg(lookaheadFrameCount).arg(settings->video.lookaheadMemorySize).toStdString());
+		}
+
+		// the export never steps backwards, so it does not need the frame cache
+		if (!videoDecoderThread->initialize(videoDecoder, settings, 0, lookaheadFrameCount))
+			throw std::runtime_error("Could not initialize video decoder thread");
+
+		videoDecoderThread->setIsGrayscaleRequested(videoStabilizer->getIsGrayscaleRequested());
+
+		if (!renderOffScreenThread->initialize(this, encodeWindow, videoDecoder, videoDecoderThread, videoStabilizer, routeManager, renderer, videoEncoder, settings))
+			throw std::runtime_error("Could not initialize off-screen render thread");
+
+		videoEncoderThread->initialize(videoEncoder, renderOffScreenThread);
 
 		connect(encodeWindow, &EncodeWindow::closing, this, &MainWindow::encodeVideoFinished);
 		connect(videoEncoderThread, &VideoEncoderThread::frameProcessed, encodeWindow, &EncodeWindow::frameProcessed);
@@ -548,12 +573,17 @@ void MainWindow::on_pushButtonBrowseQuickRouteJpegFile_clicked()
 void MainWindow::on_pushButtonBrowseInputVideoFile_clicked()
 {
 	QFileDialog fileDialog(this);
-	fileDialog.setFileMode(QFileDialog::ExistingFile);
-	fileDialog.setWindowTitle(tr("Select input video file"));
+	fileDialog.setFileMode(QFileDialog::ExistingFiles);
+	fileDialog.setWindowTitle(tr("Select input video file(s)"));
 	fileDialog.setNameFilter(tr("Video files (*.mp4 *.avi *.mkv);;All files (*.*)"));
 
+	// multiple parts of the same recording are played back in file name order
 	if (fileDialog.exec())
-		ui->lineEditInputVideoFile->setText(fileDialog.selectedFiles().at(0));
+	{
+		QStringList fileNames = fileDialog.selectedFiles();
+		fileNames.sort();
+		ui->lineEditInputVideoFile->setText(fileNames.join("|"));
+	}
 }
 
 void MainWindow::on_pushButtonBrowseOutputVideoFile_clicked()
@@ -600,7 +630,7 @@ void MainWindow::on_pushButtonVideoStabilizerBrowseInputDataFile_clicked()
 	QFileDialog fileDialog(this);
 	fileDialog.setFileMode(QFileDialog::ExistingFile);
 	fileDialog.setWindowTitle(tr("Select video stabilizer data file"));
-	fileDialog.setNameFilter(tr("CSV files (*.csv);;All files (*.*)"));
+	fileDialog.setNameFilter(tr("Stabilizer data files (*.stab);;CSV files (*.csv);;All files (*.*)"));
 
 	if (fileDialog.exec())
 		ui->lineEditVideoStabilizerInputDataFile->setText(fileDialog.selectedFiles().at(0));
@@ -611,8 +641,8 @@ void MainWindow::on_pushButtonVideoStabilizerBrowsePassOneOutputFile_clicked()
 	QFileDialog fileDialog(this);
 	fileDialog.setFileMode(QFileDialog::AnyFile);
 	fileDialog.setWindowTitle(tr("Select pass one output file"));
-	fileDialog.setNameFilter(tr("CSV files (*.csv)"));
-	fileDialog.setDefaultSuffix(tr("csv"));
+	fileDialog.setNameFilter(tr("Stabilizer data files (*.stab);;CSV files (*.csv)"));
+	fileDialog.setDefaultSuffix(tr("stab"));
 	fileDialog.setAcceptMode(QFileDialog::AcceptSave);
 
 	if (fileDialog.exec())
@@ -624,7 +654,7 @@ void MainWindow::on_pushButtonVideoStabilizerBrowsePassTwoInputFile_clicked()
 	QFileDialog fileDialog(this);
 	fileDialog.setFileMode(QFileDialog::ExistingFile);
 	fileDialog.setWindowTitle(tr("Select pass two input file"));
-	fileDialog.setNameFilter(tr("CSV files (*.csv);;All files (*.*)"));
+	fileDialog.setNameFilter(tr("Stabilizer data files (*.stab);;CSV files (*.csv);;All files (*.*)"));
 
 	if (fileDialog.exec())
 		ui->lineEditVideoStabilizerPassTwoInputFile->setText(fileDialog.selectedFiles().at(0));
@@ -635,8 +665,8 @@ void MainWindow::on_pushButtonVideoStabilizerBrowsePassTwoOutputFile_clicked()
 	QFileDialog fileDialog(this);
 	fileDialog.setFileMode(QFileDialog::AnyFile);
 	fileDialog.setWindowTitle(tr("Select pass two output file"));
-	fileDialog.setNameFilter(tr("CSV files (*.csv)"));
-	fileDialog.setDefaultSuffix(tr("csv"));
+	fileDialog.setNameFilter(tr("Stabilizer data files (*.stab);;CSV files (*.csv)"));
+	fileDialog.setDefaultSuffix(tr("stab"));
 	fileDialog.setAcceptMode(QFileDialog::AcceptSave);
 
 	if (fileDialog.exec())
@@ -656,10 +686,13 @@ void MainWindow::on_pushButtonVideoStabilizerPassOneRun_clicked()
 		videoStabilizer = new VideoStabilizer();
 		videoStabilizerThread = new VideoStabilizerThread();
 
-		if (!videoDecoder->initialize(settings))
+		// only the small grayscale frames are needed, so the image quality can be traded for speed
+		VideoDecoderProfile videoDecoderProfile = settings->stabilizer.enableFastDecoding ? VideoDecoderProfile::FastAnalysis : VideoDecoderProfile::FullQuality;
+
+		if (!videoDecoder->initialize(settings, videoDecoderProfile))
 			throw std::runtime_error("Could not initialize video decoder");
 
-		if (!videoStabilizerThread->initialize(videoDecoder, videoStabilizer, settings))
+		if (!videoStabilizerThread->initialize(videoDecoder, videoStabilizer, settings, videoDecoderProfile))
 			throw std::runtime_error("Could not initialize video stabilizer thread");
 
 		if (!videoStabilizer->initialize(settings, true))
@@ -670,6 +703,7 @@ void MainWindow::on_pushButtonVideoStabilizerPassOneRun_clicked()
 		connect(stabilizeWindow, &StabilizeWindow::closing, this, &MainWindow::stabilizeVideoFinished);
 		connect(videoStabilizerThread, &VideoStabilizerThread::frameProcessed, stabilizeWindow, &StabilizeWindow::frameProcessed);
 		connect(videoStabilizerThread, &VideoStabilizerThread::processingFinished, stabilizeWindow, &StabilizeWindow::processingFinished);
+		connect(videoStabilizerThread, &VideoStabilizerThread::processingFailed, stabilizeWindow, &StabilizeWindow::processingFailed);
 
 		stabilizeWindow->setModal(true);
 		stabilizeWindow->show();
@@ -724,18 +758,11 @@ void MainWindow::on_pushButtonVideoStabilizerPassTwoRun_clicked()
 
 	settings->readFromUI(ui);
 
-	QFile fileIn(settings->stabilizer.passTwoInputFilePath);
-	QFile fileOut(settings->stabilizer.passTwoOutputFilePath);
-
 	try
 	{
-		if (!fileIn.open(QFile::ReadOnly | QFile::Text))
-			throw std::runtime_error("Could not open input file");
-
-		if (!fileOut.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
-			throw std::runtime_error("Could not open output file");
+		if (!VideoStabilizer::convertCumulativeFramePositionsToNormalized(settings->stabilizer.passTwoInputFilePath, settings->stabilizer.passTwoOutputFilePath, settings->stabilizer.smoothingType, settings->stabilizer.smoothingRadius))
+			throw std::runtime_error("Could not run second preprocess pass");
 
-		VideoStabilizer::convertCumulativeFramePositionsToNormalized(fileIn, fileOut, settings->stabilizer.smoothingRadius);
 		QMessageBox::information(this, "OrientView - Information", "Second preprocess pass completed successfully.", QMessageBox::Ok);
 	}
 	catch (const std::exception& ex)
@@ -744,11 +771,5 @@ void MainWindow::on_pushButtonVideoStabilizerPassTwoRun_clicked()
 		QMessageBox::critical(this, "OrientView - Error", QString("%1.\n\nCheck the application log for details.").arg(ex.what()), QMessageBox::Ok);
 	}
 
-	if (fileIn.isOpen())
-		fileIn.close();
-
-	if (fileOut.isOpen())
-		fileOut.close();
-
 	this->setCursor(Qt::ArrowCursor);
 }
@@ -0,0 +1,157 @@
+// Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: GPLv3, see the LICENSE file.
+
+#define _USE_MATH_DEFINES
+#include <algorithm>
+#include <cmath>
+
+#include <QtGlobal>
+
+#include "MotionVectorEstimator.h"
+
+// the motion vector export is only available in the newer FFmpeg versions
+#ifdef CODEC_FLAG2_EXPORT_MVS
+extern "C"
+{
+#include "libavutil/motion_vector.h"
+}
+#endif
+
+using namespace OrientView;
+
+namespace
+{
+	const size_t maxVectorCount = 1024; // an even sample of the vectors is plenty for the fit
+	const size_t minVectorCount = 16;
+}
+
+bool MotionVectorEstimator::isSupported()
+{
+#ifdef CODEC_FLAG2_EXPORT_MVS
+	return true;
+#else
+	return false;
+#endif
+}
+
+// Has to be called before the codec is opened.
+void MotionVectorEstimator::enableExport(AVCodecContext* codecContext)
+{
+#ifdef CODEC_FLAG2_EXPORT_MVS
+	codecContext->flags2 |= CODEC_FLAG2_EXPORT_MVS;
+#else
+	Q_UNUSED(codecContext);
+#endif
+}
+
+// The region is the part of the decoded frame the motion is measured in, the motion is given relative to its size.
+void MotionVectorEstimator::initialize(int regionX, int regionY, int regionWidth, int regionHeight, int coordinateShift, int64_t frameInterval)
+{
+	this->regionX = regionX;
+	this->regionY = regionY;
+	this->regionWidth = std::max(1, regionWidth);
+	this->regionHeight = std::max(1, regionHeight);
+	this->coordinateShift = coordinateShift;
+	this->frameInterval = std::max((int64_t)1, frameInterval);
+
+	reset();
+}
+
+// Has to be called after a seek, the next frames do not refer to the ones before it.
+void MotionVectorEstimator::reset()
+{
+	referenceTimestamp = AV_NOPTS_VALUE;
+	previousTimestamp = AV_NOPTS_VALUE;
+}
+
+// Returns false if the frame has no usable motion vectors (e.g. intra and bidirectional frames).
+// The frames have to be given in the display order, the motion is given since the previous frame given, which also covers the skipped frames.
+bool MotionVectorEstimator::estimate(const AVFrame* frame, double& deltaX, double& deltaY, double& deltaAngle)
+{
+#ifdef CODEC_FLAG2_EXPORT_MVS
+	int64_t frameTimestamp = frame->best_effort_timestamp;
+	int64_t previousFrameTimestamp = previousTimestamp;
+	previousTimestamp = frameTimestamp;
+
+	// the bidirectional frames refer to both sides and are not references themselves
+	if (frame->pict_type == AV_PICTURE_TYPE_B)
+		return false;
+
+	// a predicted frame refers back to the previous intra or predicted frame, which can be several frames back if there are bidirectional frames in between
+	int64_t previousReferenceTimestamp = referenceTimestamp;
+	referenceTimestamp = frameTimestamp;
+
+	if (frame->pict_type == AV_PICTURE_TYPE_I || previousReferenceTimestamp == AV_NOPTS_VALUE || frameTimestamp == AV_NOPTS_VALUE)
+		return false;
+
+	int64_t referenceDistance = (frameTimestamp - previousReferenceTimestamp + frameInterval / 2) / frameInterval; // frames
+	int64_t frameDistance = (frameTimestamp - previousFrameTimestamp + frameInterval / 2) / frameInterval; // frames
+
+	if (referenceDistance < 1 || frameDistance < 1 || frameDistance > referenceDistance)
+		return false;
+
+	AVFrameSideData* sideData = av_frame_get_side_data(frame, AV_FRAME_DATA_MOTION_VECTORS);
+
+	if (sideData == nullptr)
+		return false;
+
+	const AVMotionVector* motionVectors = (const AVMotionVector*)sideData->data;
+	size_t motionVectorCount = (size_t)sideData->size / sizeof(AVMotionVector);
+	size_t step = std::max((size_t)1, motionVectorCount / maxVectorCount);
+	float coordinateScale = 1.0f / (float)(1 << coordinateShift);
+	cv::Rect_<float> region((float)regionX, (float)regionY, (float)regionWidth, (float)regionHeight);
+
+	sourcePoints.clear();
+	destinationPoints.clear();
+
+	for (size_t i = 0; i < motionVectorCount; i += step)
+	{
+		const AVMotionVector& motionVector = motionVectors[i];
+
+		// the reference of each vector is not exported, so the past references are taken to be the previous reference frame
+		if (motionVector.source >= 0)
+			continue;
+
+		cv::Point2f sourcePoint(motionVector.src_x * coordinateScale, motionVector.src_y * coordinateScale);
+		cv::Point2f destinationPoint(motionVector.dst_x * coordinateScale, motionVector.dst_y * coordinateScale);
+
+		if (!region.contains(sourcePoint) || !region.contains(destinationPoint))
+			continue;
+
+		sourcePoints.push_back(sourcePoint - region.tl());
+		destinationPoints.push_back(destinationPoint - region.tl());
+	}
+
+	if (sourcePoints.size() < minVectorCount)
+		return false;
+
+	// the vectors of the moving objects are left out as outliers
+	cv::Mat transformation = cv::estimateRigidTransform(sourcePoints, destinationPoints, false);
+
+	if (transformation.data == nullptr)
+		return false;
+
+	// a b tx
+	// c d ty
+	double c = transformation.at<double>(1, 0);
+	double d = transformation.at<double>(1, 1);
+	double tx = transformation.at<double>(0, 2);
+	double ty = transformation.at<double>(1, 2);
+
+	// the motion is spread evenly over the frames between the references
+	double referenceScale = (double)frameDistance / (double)referenceDistance;
+
+	deltaX = tx / regionWidth * referenceScale;
+	deltaY = ty / regionHeight * referenceScale;
+	deltaAngle = atan2(c, d) * 180.0 / M_PI * referenceScale;
+
+	return true;
+#else
+	Q_UNUSED(frame);
+	Q_UNUSED(deltaX);
+	Q_UNUSED(deltaY);
+	Q_UNUSED(deltaAngle);
+
+	return false;
+#endif
+}
@@ -0,0 +1,44 @@
+// Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: GPLv3, see the LICENSE file.
+
+#pragma once
+
+#include <vector>
+
+extern "C"
+{
+#include "libavcodec/avcodec.h"
+}
+
+#include "opencv2/opencv.hpp"
+
+namespace OrientView
+{
+	// Estimate the global motion of a decoded frame from the motion vectors the decoder exports, instead of looking at the image.
+	class MotionVectorEstimator
+	{
+
+	public:
+
+		static bool isSupported();
+		static void enableExport(AVCodecContext* codecContext);
+
+		void initialize(int regionX, int regionY, int regionWidth, int regionHeight, int coordinateShift, int64_t frameInterval);
+		void reset();
+		bool estimate(const AVFrame* frame, double& deltaX, double& deltaY, double& deltaAngle);
+
+	private:
+
+		int regionX = 0; // decoded frame pixels
+		int regionY = 0;
+		int regionWidth = 0;
+		int regionHeight = 0;
+		int coordinateShift = 0; // the vectors are in full size pixels, lowres frames are this many halvings smaller
+		int64_t frameInterval = 0; // video stream time base units
+		int64_t referenceTimestamp = AV_NOPTS_VALUE; // the previous intra or predicted frame, video stream time base units
+		int64_t previousTimestamp = AV_NOPTS_VALUE; // the previous frame of any type, video stream time base units
+
+		std::vector<cv::Point2f> sourcePoints;
+		std::vector<cv::Point2f> destinationPoints;
+	};
+}
@@ -0,0 +1,108 @@
+// Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: GPLv3, see the LICENSE file.
+
+#include "PacketQueue.h"
+
+using namespace OrientView;
+
+void PacketQueue::initialize(size_t maxByteCount)
+{
+	this->maxByteCount = maxByteCount;
+}
+
+PacketQueue::~PacketQueue()
+{
+	clear();
+}
+
+// Takes the ownership of the packet if it was queued.
+bool PacketQueue::push(AVPacket& packet, int packetSerial)
+{
+	QMutexLocker locker(&queueMutex);
+
+	// a single packet larger than the limit still gets through an empty queue
+	while (!isAborted && packetSerial == serial && !packets.empty() && byteCount + (size_t)packet.size > maxByteCount)
+		spaceAvailable.wait(&queueMutex);
+
+	if (isAborted || packetSerial != serial)
+		return false;
+
+	packets.push_back(packet);
+	byteCount += (size_t)packet.size;
+	packetAvailable.wakeAll();
+
+	return true;
+}
+
+// Blocks until there is a packet or the stream has ended. The caller owns the returned packet.
+bool PacketQueue::pop(AVPacket& packet)
+{
+	QMutexLocker locker(&queueMutex);
+
+	while (!isAborted && !isEndOfStream && packets.empty())
+		packetAvailable.wait(&queueMutex);
+
+	if (isAborted || packets.empty())
+		return false;
+
+	packet = packets.front();
+	packets.pop_front();
+	byteCount -= (size_t)packet.size;
+	spaceAvailable.wakeAll();
+
+	return true;
+}
+
+int PacketQueue::flush()
+{
+	QMutexLocker locker(&queueMutex);
+
+	clear();
+	isEndOfStream = false;
+	spaceAvailable.wakeAll();
+
+	return ++serial;
+}
+
+void PacketQueue::setEndOfStream(int packetSerial)
+{
+	QMutexLocker locker(&queueMutex);
+
+	if (packetSerial != serial)
+		return;
+
+	isEndOfStream = true;
+	packetAvailable.wakeAll();
+}
+
+void PacketQueue::abort()
+{
+	QMutexLocker locker(&queueMutex);
+
+	isAborted = true;
+	packetAvailable.wakeAll();
+	spaceAvailable.wakeAll();
+}
+
+int PacketQueue::getSerial()
+{
+	QMutexLocker locker(&queueMutex);
+
+	return serial;
+}
+
+size_t PacketQueue::getByteCount()
+{
+	QMutexLocker locker(&queueMutex);
+
+	return byteCount;
+}
+
+void PacketQueue::clear()
+{
+	for (AVPacket& packet : packets)
+		av_free_packet(&packet);
+
+	packets.clear();
+	byteCount = 0;
+}
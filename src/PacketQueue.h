@@ -0,0 +1,52 @@
+// Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: GPLv3, see the LICENSE file.
+
+#pragma once
+
+#include <deque>
+
+#include <QMutex>
+#include <QWaitCondition>
+
+extern "C"
+{
+#include "libavcodec/avcodec.h"
+}
+
+namespace OrientView
+{
+	// Thread safe FIFO queue of compressed packets limited by the total size of the packet data.
+	// Every flush starts a new serial and packets read before it are refused.
+	class PacketQueue
+	{
+
+	public:
+
+		void initialize(size_t maxByteCount);
+		~PacketQueue();
+
+		bool push(AVPacket& packet, int packetSerial);
+		bool pop(AVPacket& packet);
+		int flush();
+		void setEndOfStream(int packetSerial);
+		void abort();
+
+		int getSerial();
+		size_t getByteCount();
+
+	private:
+
+		void clear();
+
+		QMutex queueMutex;
+		QWaitCondition packetAvailable;
+		QWaitCondition spaceAvailable;
+
+		std::deque<AVPacket> packets;
+		size_t byteCount = 0;
+		size_t maxByteCount = 0;
+		int serial = 0;
+		bool isEndOfStream = false;
+		bool isAborted = false;
+	};
+}
@@ -0,0 +1,57 @@
+// Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: GPLv3, see the LICENSE file.
+
+#include <algorithm>
+
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThreadPool>
+
+#include "ParallelTaskRunner.h"
+
+using namespace OrientView;
+
+namespace
+{
+	class PoolTask : public QRunnable
+	{
+
+	public:
+
+		explicit PoolTask(const std::function<void()>& function) : function(function) {}
+		void run() { function(); }
+
+	private:
+
+		std::function<void()> function;
+	};
+}
+
+// The tasks are dealt to at most threadCount groups. The calling thread runs the first group itself.
+void ParallelTaskRunner::run(int taskCount, int threadCount, const std::function<void(int)>& task)
+{
+	int groupCount = std::min(threadCount, taskCount);
+
+	if (groupCount <= 0)
+		return;
+
+	auto runGroup = [&task, taskCount, groupCount](int groupIndex)
+	{
+		for (int i = groupIndex; i < taskCount; i += groupCount)
+			task(i);
+	};
+
+	QSemaphore finishedSemaphore;
+
+	for (int i = 1; i < groupCount; ++i)
+	{
+		QThreadPool::globalInstance()->start(new PoolTask([&runGroup, &finishedSemaphore, i]()
+		{
+			runGroup(i);
+			finishedSemaphore.release(1);
+		}));
+	}
+
+	runGroup(0);
+	finishedSemaphore.acquire(groupCount - 1);
+}
@@ -0,0 +1,18 @@
+// Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: GPLv3, see the LICENSE file.
+
+#pragma once
+
+#include <functional>
+
+namespace OrientView
+{
+	// Run the parts of a job in parallel on the shared thread pool and wait for them to finish.
+	class ParallelTaskRunner
+	{
+
+	public:
+
+		static void run(int taskCount, int threadCount, const std::function<void(int)>& task);
+	};
+}
@@ -0,0 +1,107 @@
+// Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: GPLv3, see the LICENSE file.
+
+#include <cmath>
+
+#include "PhaseCorrelator.h"
+
+using namespace OrientView;
+
+void PhaseCorrelator::reset()
+{
+	hasPreviousSpectrum = false;
+}
+
+// Returns false if there is nothing to compare the image to or the match is too weak.
+bool PhaseCorrelator::estimate(const cv::Mat& image, double& deltaX, double& deltaY)
+{
+	if (image.size() != imageSize)
+		initialize(image.size());
+
+	// the window fades the edges out, so the wrap around of the DFT does not show up as a match at zero
+	cv::Mat windowedRegion = windowedImage(cv::Rect(0, 0, imageSize.width, imageSize.height));
+	image.convertTo(windowedRegion, CV_32F);
+	windowedRegion -= cv::mean(windowedRegion);
+	cv::multiply(windowedRegion, window, windowedRegion);
+
+	cv::dft(windowedImage, currentSpectrum, cv::DFT_COMPLEX_OUTPUT);
+
+	bool hasMatch = false;
+
+	if (hasPreviousSpectrum)
+	{
+		cv::mulSpectrums(currentSpectrum, previousSpectrum, crossPowerSpectrum, 0, true);
+
+		// only the phase is kept
+		for (int y = 0; y < crossPowerSpectrum.rows; ++y)
+		{
+			float* row = crossPowerSpectrum.ptr<float>(y);
+
+			for (int x = 0; x < crossPowerSpectrum.cols; ++x)
+			{
+				float magnitude = sqrtf(row[2 * x] * row[2 * x] + row[2 * x + 1] * row[2 * x + 1]) + 1e-6f;
+
+				row[2 * x] /= magnitude;
+				row[2 * x + 1] /= magnitude;
+			}
+		}
+
+		cv::dft(crossPowerSpectrum, correlation, cv::DFT_INVERSE | cv::DFT_REAL_OUTPUT | cv::DFT_SCALE);
+
+		double peakValue = 0.0;
+		cv::Point peak;
+		cv::minMaxLoc(correlation, nullptr, &peakValue, nullptr, &peak);
+
+		if (peakValue >= minResponse)
+		{
+			// centroid of the 3x3 neighbourhood for the sub-pixel position, the correlation wraps around at the edges
+			double sum = 0.0;
+			double sumX = 0.0;
+			double sumY = 0.0;
+
+			for (int j = -1; j <= 1; ++j)
+			{
+				const float* row = correlation.ptr<float>((peak.y + j + dftSize.height) % dftSize.height);
+
+				for (int i = -1; i <= 1; ++i)
+				{
+					double value = row[(peak.x + i + dftSize.width) % dftSize.width];
+
+					sum += value;
+					sumX += value * i;
+					sumY += value * j;
+				}
+			}
+
+			deltaX = peak.x + ((sum > 0.0) ? sumX / sum : 0.0);
+			deltaY = peak.y + ((sum > 0.0) ? sumY / sum : 0.0);
+
+			// the shifts past the halfway point are negative
+			if (deltaX > dftSize.width / 2)
+				deltaX -= dftSize.width;
+
+			if (deltaY > dftSize.height / 2)
+				deltaY -= dftSize.height;
+
+			hasMatch = true;
+		}
+	}
+
+	std::swap(previousSpectrum, currentSpectrum);
+	hasPreviousSpectrum = true;
+
+	return hasMatch;
+}
+
+void PhaseCorrelator::initialize(const cv::Size& imageSize)
+{
+	this->imageSize = imageSize;
+
+	dftSize.width = cv::getOptimalDFTSize(imageSize.width);
+	dftSize.height = cv::getOptimalDFTSize(imageSize.height);
+
+	cv::createHanningWindow(window, imageSize, CV_32F);
+	windowedImage = cv::Mat::zeros(dftSize, CV_32F);
+
+	hasPreviousSpectrum = false;
+}
@@ -0,0 +1,37 @@
+// Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: GPLv3, see the LICENSE file.
+
+#pragma once
+
+#include "opencv2/opencv.hpp"
+
+namespace OrientView
+{
+	// Measure the translation from frame to frame with windowed phase correlation.
+	// The spectrum of each image is kept for the next pair and all the buffers are reused, so every image costs one forward and one inverse DFT.
+	class PhaseCorrelator
+	{
+
+	public:
+
+		void reset();
+		bool estimate(const cv::Mat& image, double& deltaX, double& deltaY);
+
+	private:
+
+		void initialize(const cv::Size& imageSize);
+
+		cv::Size imageSize;
+		cv::Size dftSize;
+		double minResponse = 0.02; // fraction of the correlation in the peak, below it the images have too little in common
+
+		bool hasPreviousSpectrum = false;
+
+		cv::Mat window;
+		cv::Mat windowedImage; // padded to the DFT size
+		cv::Mat previousSpectrum;
+		cv::Mat currentSpectrum;
+		cv::Mat crossPowerSpectrum;
+		cv::Mat correlation;
+	};
+}
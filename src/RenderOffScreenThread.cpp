@@ -1,6 +1,9 @@
 // Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
 // License: GPLv3, see the LICENSE file.
 
+#include <algorithm>
+#include <deque>
+
 #include <QElapsedTimer>
 
 #include "RenderOffScreenThread.h"
@@ -12,11 +15,11 @@
 #include "RouteManager.h"
 #include "Renderer.h"
 #include "VideoEncoder.h"
-#include "FrameData.h"
+#include "Settings.h"
 
 using namespace OrientView;
 
-void RenderOffScreenThread::initialize(MainWindow* mainWindow, EncodeWindow* encodeWindow, VideoDecoder* videoDecoder, VideoDecoderThread* videoDecoderThread, VideoStabilizer* videoStabilizer, RouteManager* routeManager, Renderer* renderer, VideoEncoder* videoEncoder)
+bool RenderOffScreenThread::initialize(MainWindow* mainWindow, EncodeWindow* encodeWindow, VideoDecoder* videoDecoder, VideoDecoderThread* videoDecoderThread, VideoStabilizer* videoStabilizer, RouteManager* routeManager, Renderer* renderer, VideoEncoder* videoEncoder, Settings* settings)
 {
 	this->mainWindow = mainWindow;
 	this->encodeWindow = encodeWindow;
@@ -27,77 +30,127 @@ void RenderOffScreenThread::initialize(MainWindow* mainWindow, EncodeWindow* enc
 	this->renderer = renderer;
 	this->videoEncoder = videoEncoder;
 
-	frameReadSemaphore = new QSemaphore();
-	frameAvailableSemaphore = new QSemaphore();
-}
+	lookaheadFrameCount = videoStabilizer->getLookaheadFrameCount();
 
-RenderOffScreenThread::~RenderOffScreenThread()
-{
-	if (frameAvailableSemaphore != nullptr)
-	{
-		delete frameAvailableSemaphore;
-		frameAvailableSemaphore = nullptr;
-	}
+	int frameQueueSize = std::max(1, settings->encoder.frameQueueSize);
 
-	if (frameReadSemaphore != nullptr)
+	// the producer and the consumer both need one extra frame in addition to the queued ones
+	if (!framePool.initialize(frameQueueSize + 2, (size_t)(settings->window.width * settings->window.height * 4)))
 	{
-		delete frameReadSemaphore;
-		frameReadSemaphore = nullptr;
+		qWarning("Could not initialize frame pool");
+		return false;
 	}
+
+	frameQueue.initialize(frameQueueSize);
+
+	return true;
 }
 
 void RenderOffScreenThread::run()
 {
-	FrameData decodedFrameData;
-	FrameData decodedFrameDataGrayscale;
-
-	double frameDuration = videoDecoder->getFrameDuration();
-
-	frameReadSemaphore->release(1);
+	// the lookahead stabilization needs the frames after the one being rendered, so they wait here
+	std::deque<DecodedFrame> delayedFrames;
 
 	while (!isInterruptionRequested())
 	{
-		if (videoDecoderThread->tryGetNextFrame(decodedFrameData, decodedFrameDataGrayscale, 100))
+		DecodedFrame decodedFrame;
+
+		if (videoDecoderThread->tryGetNextFrame(decodedFrame.frameData, decodedFrame.frameDataGrayscale, 100))
 		{
-			videoStabilizer->processFrame(decodedFrameDataGrayscale);
-			routeManager->update(videoDecoder->getCurrentTime(), frameDuration);
+			if (lookaheadFrameCount > 0)
+				videoStabilizer->addLookaheadFrame(decodedFrame.frameDataGrayscale);
+			else
+				videoStabilizer->processFrame(decodedFrame.frameDataGrayscale);
 
-			encodeWindow->getContext()->makeCurrent(encodeWindow->getSurface());
-			renderer->startRendering(videoDecoder->getCurrentTime(), frameDuration, 0.0, videoDecoder->getLastDecodeTime(), videoStabilizer->getLastProcessTime(), videoEncoder->getLastEncodeTime());
-			renderer->uploadFrameData(decodedFrameData);
-			videoDecoderThread->signalFrameRead();
-			renderer->renderAll();
-			renderer->stopRendering();
+			delayedFrames.push_back(decodedFrame);
 
-			while (!frameReadSemaphore->tryAcquire(1, 100) && !isInterruptionRequested()) {}
+			if ((int)delayedFrames.size() > lookaheadFrameCount)
+			{
+				DecodedFrame delayedFrame = delayedFrames.front();
+				delayedFrames.pop_front();
 
-			if (isInterruptionRequested())
-				break;
+				if (!renderFrame(delayedFrame))
+					break;
+			}
+		}
+		else if (videoDecoderThread->getIsFinished())
+		{
+			while (!delayedFrames.empty() && !isInterruptionRequested())
+			{
+				DecodedFrame delayedFrame = delayedFrames.front();
+				delayedFrames.pop_front();
 
-			renderedFrameData = renderer->getRenderedFrame();
-			renderedFrameData.duration = decodedFrameData.duration;
-			renderedFrameData.cumulativeNumber = decodedFrameData.cumulativeNumber;
+				if (!renderFrame(delayedFrame))
+					break;
+			}
 
-			frameAvailableSemaphore->release(1);
+			isFinished.store(1);
 		}
 	}
 
+	for (DecodedFrame& delayedFrame : delayedFrames)
+		videoDecoderThread->releaseFrame(delayedFrame.frameData, delayedFrame.frameDataGrayscale);
+
 	encodeWindow->getContext()->doneCurrent();
 	encodeWindow->getContext()->moveToThread(mainWindow->thread());
 }
 
-bool RenderOffScreenThread::tryGetNextFrame(FrameData& frameData, int timeout)
+// Returns false if interrupted, the decoded frame is released in any case.
+bool RenderOffScreenThread::renderFrame(DecodedFrame& decodedFrame)
 {
-	if (frameAvailableSemaphore->tryAcquire(1, timeout))
+	FrameData& decodedFrameData = decodedFrame.frameData;
+	FrameData renderedFrameData;
+
+	double frameDuration = videoDecoder->getFrameDuration();
+
+	if (lookaheadFrameCount > 0)
+		videoStabilizer->processLookaheadFrame();
+
+	routeManager->update(decodedFrameData.time, frameDuration);
+
+	encodeWindow->getContext()->makeCurrent(encodeWindow->getSurface());
+	renderer->startRendering(decodedFrameData.time, frameDuration, 0.0, videoDecoder->getLastDecodeTime(), videoStabilizer->getLastProcessTime(), videoEncoder->getLastEncodeTime());
+	renderer->uploadFrameData(decodedFrameData);
+	renderer->renderAll();
+	renderer->stopRendering();
+
+	while (!framePool.tryAcquireFrame(renderedFrameData, 100) && !isInterruptionRequested()) {}
+
+	if (isInterruptionRequested())
 	{
-		frameData = renderedFrameData;
-		return true;
+		videoDecoderThread->releaseFrame(decodedFrame.frameData, decodedFrame.frameDataGrayscale);
+		return false;
 	}
-	else
+
+	renderer->getRenderedFrame(renderedFrameData);
+	renderedFrameData.duration = decodedFrameData.duration;
+	renderedFrameData.cumulativeNumber = decodedFrameData.cumulativeNumber;
+	renderedFrameData.time = decodedFrameData.time;
+
+	videoDecoderThread->releaseFrame(decodedFrame.frameData, decodedFrame.frameDataGrayscale);
+
+	while (!frameQueue.tryPush(renderedFrameData, 100) && !isInterruptionRequested()) {}
+
+	if (isInterruptionRequested())
+	{
+		framePool.releaseFrame(renderedFrameData);
 		return false;
+	}
+
+	return true;
+}
+
+bool RenderOffScreenThread::tryGetNextFrame(FrameData& frameData, int timeout)
+{
+	return frameQueue.tryPop(frameData, timeout);
+}
+
+void RenderOffScreenThread::releaseFrame(FrameData& frameData)
+{
+	framePool.releaseFrame(frameData);
 }
 
-void RenderOffScreenThread::signalFrameRead()
+bool RenderOffScreenThread::getIsFinished() const
 {
-	frameReadSemaphore->release(1);
+	return (isFinished.load() != 0 && frameQueue.getCount() == 0);
 }
@@ -4,9 +4,11 @@
 #pragma once
 
 #include <QThread>
-#include <QSemaphore>
+#include <QAtomicInt>
 
 #include "FrameData.h"
+#include "FramePool.h"
+#include "BoundedQueue.h"
 
 namespace OrientView
 {
@@ -18,6 +20,7 @@ namespace OrientView
 	class RouteManager;
 	class Renderer;
 	class VideoEncoder;
+	class Settings;
 
 	// Run renderer on a thread and draw to hidden framebuffers.
 	class RenderOffScreenThread : public QThread
@@ -26,11 +29,12 @@ namespace OrientView
 
 	public:
 
-		void initialize(MainWindow* mainWindow, EncodeWindow* encodeWindow, VideoDecoder* videoDecoder, VideoDecoderThread* videoDecoderThread, VideoStabilizer* videoStabilizer, RouteManager* routeManager, Renderer* renderer, VideoEncoder* videoEncoder);
-		~RenderOffScreenThread();
+		bool initialize(MainWindow* mainWindow, EncodeWindow* encodeWindow, VideoDecoder* videoDecoder, VideoDecoderThread* videoDecoderThread, VideoStabilizer* videoStabilizer, RouteManager* routeManager, Renderer* renderer, VideoEncoder* videoEncoder, Settings* settings);
 
 		bool tryGetNextFrame(FrameData& frameData, int timeout);
-		void signalFrameRead();
+		void releaseFrame(FrameData& frameData);
+
+		bool getIsFinished() const;
 
 	protected:
 
@@ -38,6 +42,14 @@ namespace OrientView
 
 	private:
 
+		struct DecodedFrame
+		{
+			FrameData frameData;
+			FrameData frameDataGrayscale;
+		};
+
+		bool renderFrame(DecodedFrame& decodedFrame);
+
 		MainWindow* mainWindow = nullptr;
 		EncodeWindow* encodeWindow = nullptr;
 		VideoDecoder* videoDecoder = nullptr;
@@ -47,9 +59,11 @@ namespace OrientView
 		Renderer* renderer = nullptr;
 		VideoEncoder* videoEncoder = nullptr;
 
-		QSemaphore* frameReadSemaphore = nullptr;
-		QSemaphore* frameAvailableSemaphore = nullptr;
+		int lookaheadFrameCount = 0; // decoded frames held back for the stabilizer
+
+		FramePool framePool;
+		BoundedQueue<FrameData> frameQueue;
 
-		FrameData renderedFrameData;
+		QAtomicInt isFinished;
 	};
 }
@@ -38,6 +38,8 @@ void RenderOnScreenThread::run()
 
 	double frameDuration = 0.1;
 	double spareTime = 0.0;
+	double currentTime = 0.0;
+	int64_t currentFrameDuration = 0;
 
 	displaySyncTimer.start();
 	spareTimer.start();
@@ -52,24 +54,40 @@ void RenderOnScreenThread::run()
 
 		bool gotFrame = false;
 
-		if (!isPaused || shouldAdvanceOneFrame)
+		if (shouldStepBackOneFrame)
+		{
+			gotFrame = videoDecoderThread->tryGetPreviousFrame(frameData, frameDataGrayscale);
+			shouldStepBackOneFrame = false;
+
+			// otherwise the decoder was moved back and the frame will come through the queue
+			if (!gotFrame)
+				shouldAdvanceOneFrame = true;
+		}
+		else if (!isPaused || shouldAdvanceOneFrame)
 		{
 			gotFrame = videoDecoderThread->tryGetNextFrame(frameData, frameDataGrayscale, 0);
-			shouldAdvanceOneFrame = false;
+
+			// keep the advance request pending until the frame has actually been decoded
+			if (gotFrame)
+				shouldAdvanceOneFrame = false;
 		}
 
 		if (gotFrame)
+		{
 			videoStabilizer->processFrame(frameDataGrayscale);
+			currentTime = frameData.time;
+			currentFrameDuration = frameData.duration;
+		}
 
-		routeManager->update(videoDecoder->getCurrentTime(), frameDuration);
+		routeManager->update(currentTime, frameDuration);
 
 		videoWindow->getContext()->makeCurrent(videoWindow);
-		renderer->startRendering(videoDecoder->getCurrentTime(), frameDuration, spareTime, videoDecoder->getLastDecodeTime(), videoStabilizer->getLastProcessTime(), 0.0);
+		renderer->startRendering(currentTime, frameDuration, spareTime, videoDecoder->getLastDecodeTime(), videoStabilizer->getLastProcessTime(), 0.0);
 
 		if (gotFrame)
 		{
 			renderer->uploadFrameData(frameData);
-			videoDecoderThread->signalFrameRead();
+			videoDecoderThread->releaseFrame(frameData, frameDataGrayscale);
 		}
 
 		renderer->renderAll();
@@ -85,12 +103,12 @@ void RenderOnScreenThread::run()
 			windowHasBeenResized = false;
 		}
 
-		spareTime = (frameData.duration - (spareTimer.nsecsElapsed() / 1000.0)) / 1000.0;
+		spareTime = (currentFrameDuration - (spareTimer.nsecsElapsed() / 1000.0)) / 1000.0;
 
 		// use combination of normal and spinning wait to sync the frame rate accurately
 		while (true)
 		{
-			int64_t timeToSleep = frameData.duration - (displaySyncTimer.nsecsElapsed() / 1000);
+			int64_t timeToSleep = currentFrameDuration - (displaySyncTimer.nsecsElapsed() / 1000);
 
 			if (timeToSleep > 2000)
 			{
@@ -123,6 +141,7 @@ void RenderOnScreenThread::togglePaused()
 {
 	isPaused = !isPaused;
 	shouldAdvanceOneFrame = false;
+	shouldStepBackOneFrame = false;
 }
 
 void RenderOnScreenThread::advanceOneFrame()
@@ -130,6 +149,12 @@ void RenderOnScreenThread::advanceOneFrame()
 	shouldAdvanceOneFrame = true;
 }
 
+void RenderOnScreenThread::stepBackOneFrame()
+{
+	shouldAdvanceOneFrame = false;
+	shouldStepBackOneFrame = true;
+}
+
 void RenderOnScreenThread::windowResized(int newWidth, int newHeight)
 {
 	windowWidth = newWidth;
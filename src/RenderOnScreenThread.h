@@ -28,6 +28,7 @@ namespace OrientView
 		bool getIsPaused();
 		void togglePaused();
 		void advanceOneFrame();
+		void stepBackOneFrame();
 
 		public slots:
 
@@ -50,6 +51,7 @@ namespace OrientView
 
 		bool isPaused = false;
 		bool shouldAdvanceOneFrame = false;
+		bool shouldStepBackOneFrame = false;
 		bool windowHasBeenResized = false;
 
 		int windowWidth = 0;
@@ -1,6 +1,10 @@
 // Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
 // License: GPLv3, see the LICENSE file.
 
+#include <algorithm>
+#include <cmath>
+
+#include <QFile>
 #include <QOpenGLPixelTransferOptions>
 
 #include "Renderer.h"
@@ -14,10 +18,42 @@
 
 using namespace OrientView;
 
+namespace
+{
+	// Maps normalized texture values (Y, U, V, 1) to RGB, including the range expansion.
+	QMatrix4x4 getYuvToRgbMatrix(bool isBt709, bool isFullRange)
+	{
+		double kr = isBt709 ? 0.2126 : 0.299;
+		double kb = isBt709 ? 0.0722 : 0.114;
+		double kg = 1.0 - kr - kb;
+
+		// limited range is Y 16-235 and UV 16-240
+		double yScale = isFullRange ? 1.0 : 255.0 / 219.0;
+		double yOffset = isFullRange ? 0.0 : -16.0 / 219.0;
+		double uvScale = isFullRange ? 1.0 : 255.0 / 224.0;
+		double uvOffset = -128.0 / 255.0 * uvScale;
+
+		QMatrix4x4 rangeMatrix(
+			yScale, 0.0, 0.0, yOffset,
+			0.0, uvScale, 0.0, uvOffset,
+			0.0, 0.0, uvScale, uvOffset,
+			0.0, 0.0, 0.0, 1.0);
+
+		QMatrix4x4 conversionMatrix(
+			1.0, 0.0, 2.0 * (1.0 - kr), 0.0,
+			1.0, -2.0 * kb * (1.0 - kb) / kg, -2.0 * kr * (1.0 - kr) / kg, 0.0,
+			1.0, 2.0 * (1.0 - kb), 0.0, 0.0,
+			0.0, 0.0, 0.0, 1.0);
+
+		return conversionMatrix * rangeMatrix;
+	}
+}
+
 bool Renderer::initialize(VideoDecoder* videoDecoder, MapImageReader* mapImageReader, VideoStabilizer* videoStabilizer, InputHandler* inputHandler, RouteManager* routeManager, Settings* settings)
 {
 	qDebug("Initializing renderer");
 
+	this->videoDecoder = videoDecoder;
 	this->videoStabilizer = videoStabilizer;
 	this->inputHandler = inputHandler;
 	this->routeManager = routeManager;
@@ -31,8 +67,9 @@ bool Renderer::initialize(VideoDecoder* videoDecoder, MapImageReader* mapImageRe
 	videoPanel.userScale = settings->video.scale;
 	videoPanel.textureWidth = videoDecoder->getFrameWidth();
 	videoPanel.textureHeight = videoDecoder->getFrameHeight();
-	videoPanel.texelWidth = 1.0 / videoPanel.textureWidth;
-	videoPanel.texelHeight = 1.0 / videoPanel.textureHeight;
+	videoPanel.yuvToRgbMatrix = getYuvToRgbMatrix(videoDecoder->getIsBt709(), videoDecoder->getIsFullRange());
+
+	isYuvVideo = videoDecoder->getIsYuvOutput();
 
 	mapPanel.clearColor = settings->map.backgroundColor;
 	mapPanel.userX = settings->map.x;
@@ -41,10 +78,17 @@ bool Renderer::initialize(VideoDecoder* videoDecoder, MapImageReader* mapImageRe
 	mapPanel.userScale = settings->map.scale;
 	mapPanel.textureWidth = mapImageReader->getMapImage().width();
 	mapPanel.textureHeight = mapImageReader->getMapImage().height();
+	mapPanel.textureDataWidth = mapPanel.textureWidth;
+	mapPanel.textureDataHeight = mapPanel.textureHeight;
 	mapPanel.texelWidth = 1.0 / mapPanel.textureWidth;
 	mapPanel.texelHeight = 1.0 / mapPanel.textureHeight;
 	mapPanel.relativeWidth = settings->map.relativeWidth;
 
+	requestedVideoFrameWidth = (int)videoPanel.textureWidth;
+	enableDisplaySizeDecoding = settings->video.enableDisplaySizeDecoding;
+	enableDisplaySizeDecodingWhenEncoding = settings->encoder.enableDisplaySizeDecoding;
+	displaySizeMargin = settings->video.displaySizeMargin;
+
 	multisamples = settings->window.multisamples;
 	showInfoPanel = settings->window.showInfoPanel;
 
@@ -62,10 +106,10 @@ bool Renderer::initialize(VideoDecoder* videoDecoder, MapImageReader* mapImageRe
 	if (!windowResized(settings->window.width, settings->window.height))
 		return false;
 
-	if (!loadShaders(videoPanel, settings->video.rescaleShader))
+	if (!loadShaders(videoPanel, settings->video.rescaleShader, isYuvVideo))
 		return false;
 
-	if (!loadShaders(mapPanel, settings->map.rescaleShader))
+	if (!loadShaders(mapPanel, settings->map.rescaleShader, false))
 		return false;
 
 	// 1 2
@@ -101,16 +145,7 @@ bool Renderer::initialize(VideoDecoder* videoDecoder, MapImageReader* mapImageRe
 	loadBuffer(videoPanel, videoPanelBuffer, 20);
 	loadBuffer(mapPanel, mapPanelBuffer, 20);
 
-	videoPanel.texture = new QOpenGLTexture(QOpenGLTexture::Target2D);
-	videoPanel.texture->create();
-	videoPanel.texture->bind();
-	videoPanel.texture->setSize(videoPanel.textureWidth, videoPanel.textureHeight);
-	videoPanel.texture->setFormat(QOpenGLTexture::RGBA8_UNorm);
-	videoPanel.texture->setMinificationFilter(QOpenGLTexture::Linear);
-	videoPanel.texture->setMagnificationFilter(QOpenGLTexture::Linear);
-	videoPanel.texture->setWrapMode(QOpenGLTexture::ClampToEdge);
-	videoPanel.texture->allocateStorage();
-	videoPanel.texture->release();
+	createVideoTextures((int)videoPanel.textureWidth, (int)videoPanel.textureHeight, videoDecoder->getChromaFrameWidth(), videoDecoder->getChromaFrameHeight());
 
 	mapPanel.texture = new QOpenGLTexture(mapImageReader->getMapImage());
 	mapPanel.texture->bind();
@@ -166,30 +201,11 @@ bool Renderer::windowResized(int newWidth, int newHeight)
 		return false;
 	}
 
-	if (renderedFrameData.data != nullptr)
-	{
-		delete renderedFrameData.data;
-		renderedFrameData.data = nullptr;
-	}
-
-	renderedFrameData = FrameData();
-	renderedFrameData.dataLength = (size_t)(windowWidth * windowHeight * 4);
-	renderedFrameData.rowLength = (size_t)(windowWidth * 4);
-	renderedFrameData.data = new uint8_t[renderedFrameData.dataLength];
-	renderedFrameData.width = windowWidth;
-	renderedFrameData.height = windowHeight;
-
 	return true;
 }
 
 Renderer::~Renderer()
 {
-	if (renderedFrameData.data != nullptr)
-	{
-		delete renderedFrameData.data;
-		renderedFrameData.data = nullptr;
-	}
-
 	if (outputFramebufferNonMultisample != nullptr)
 	{
 		delete outputFramebufferNonMultisample;
@@ -220,11 +236,7 @@ Renderer::~Renderer()
 		mapPanel.texture = nullptr;
 	}
 
-	if (videoPanel.texture != nullptr)
-	{
-		delete videoPanel.texture;
-		videoPanel.texture = nullptr;
-	}
+	deleteVideoTextures();
 
 	if (mapPanel.buffer != nullptr)
 	{
@@ -251,14 +263,28 @@ Renderer::~Renderer()
 	}
 }
 
-bool Renderer::loadShaders(Panel& panel, const QString& shaderName)
+bool Renderer::loadShaders(Panel& panel, const QString& shaderName, bool isYuvInput)
 {
 	panel.program = new QOpenGLShaderProgram();
 
 	if (!panel.program->addShaderFromSourceFile(QOpenGLShader::Vertex, QString("data/shaders/%1.vert").arg(shaderName)))
 		return false;
 
-	if (!panel.program->addShaderFromSourceFile(QOpenGLShader::Fragment, QString("data/shaders/%1.frag").arg(shaderName)))
+	QFile fragmentShaderFile(QString("data/shaders/%1.frag").arg(shaderName));
+
+	if (!fragmentShaderFile.open(QIODevice::ReadOnly | QIODevice::Text))
+	{
+		qWarning("Could not open fragment shader file: %s", qPrintable(fragmentShaderFile.fileName()));
+		return false;
+	}
+
+	QByteArray fragmentShaderSource = fragmentShaderFile.readAll();
+
+	// the YUV sampling code is enabled with a define which has to come after the #version line
+	if (isYuvInput)
+		fragmentShaderSource.insert(fragmentShaderSource.indexOf('\n') + 1, "#define YUV_INPUT\n");
+
+	if (!panel.program->addShaderFromSourceCode(QOpenGLShader::Fragment, fragmentShaderSource))
 		return false;
 
 	if (!panel.program->link())
@@ -280,6 +306,9 @@ bool Renderer::loadShaders(Panel& panel, const QString& shaderName)
 	panel.textureHeightUniform = panel.program->uniformLocation("textureHeight");
 	panel.texelWidthUniform = panel.program->uniformLocation("texelWidth");
 	panel.texelHeightUniform = panel.program->uniformLocation("texelHeight");
+	panel.textureSamplerUUniform = panel.program->uniformLocation("textureSamplerU");
+	panel.textureSamplerVUniform = panel.program->uniformLocation("textureSamplerV");
+	panel.yuvToRgbMatrixUniform = panel.program->uniformLocation("yuvToRgbMatrix");
 
 	return true;
 }
@@ -316,13 +345,38 @@ void Renderer::startRendering(double currentTime, double frameTime, double spare
 
 void Renderer::uploadFrameData(const FrameData& frameData)
 {
+	// the decoder output size follows the size of the video panel
+	if (frameData.width != (int)videoPanel.textureDataWidth || frameData.height != (int)videoPanel.textureDataHeight)
+		createVideoTextures(frameData.width, frameData.height, frameData.chromaWidth, frameData.chromaHeight);
+
 	QOpenGLPixelTransferOptions options;
 
-	options.setRowLength((int)(frameData.rowLength / 4));
-	options.setImageHeight(frameData.height);
-	options.setAlignment(1);
+	if (!isYuvVideo)
+	{
+		options.setRowLength((int)(frameData.rowLength / 4));
+		options.setImageHeight(frameData.height);
+		options.setAlignment(1);
+
+		videoPanel.texture->setData(QOpenGLTexture::RGBA, QOpenGLTexture::UInt8, frameData.data, &options);
+	}
+	else
+	{
+		uint8_t* planeY = frameData.data;
+		uint8_t* planeU = planeY + frameData.rowLength * (size_t)frameData.height;
+		uint8_t* planeV = planeU + frameData.chromaRowLength * (size_t)frameData.chromaHeight;
+
+		options.setRowLength((int)frameData.rowLength);
+		options.setImageHeight(frameData.height);
+		options.setAlignment(1);
+
+		videoPanel.texture->setData(QOpenGLTexture::Red, QOpenGLTexture::UInt8, planeY, &options);
+
+		options.setRowLength((int)frameData.chromaRowLength);
+		options.setImageHeight(frameData.chromaHeight);
 
-	videoPanel.texture->setData(QOpenGLTexture::RGBA, QOpenGLTexture::UInt8, frameData.data, &options);
+		videoPanel.textureU->setData(QOpenGLTexture::Red, QOpenGLTexture::UInt8, planeU, &options);
+		videoPanel.textureV->setData(QOpenGLTexture::Red, QOpenGLTexture::UInt8, planeV, &options);
+	}
 }
 
 void Renderer::renderAll()
@@ -361,7 +415,7 @@ void Renderer::stopRendering()
 	lastRenderTime = renderTimer.nsecsElapsed() / 1000000.0;
 }
 
-FrameData Renderer::getRenderedFrame()
+void Renderer::getRenderedFrame(FrameData& frameData)
 {
 	QOpenGLFramebufferObject* sourceFbo = outputFramebuffer;
 
@@ -374,11 +428,14 @@ FrameData Renderer::getRenderedFrame()
 		sourceFbo = outputFramebufferNonMultisample;
 	}
 
+	frameData.dataLength = (size_t)(windowWidth * windowHeight * 4);
+	frameData.rowLength = (size_t)(windowWidth * 4);
+	frameData.width = windowWidth;
+	frameData.height = windowHeight;
+
 	sourceFbo->bind();
-	glReadPixels(0, 0, windowWidth, windowHeight, GL_RGBA, GL_UNSIGNED_BYTE, renderedFrameData.data);
+	glReadPixels(0, 0, windowWidth, windowHeight, GL_RGBA, GL_UNSIGNED_BYTE, frameData.data);
 	sourceFbo->release();
-
-	return renderedFrameData;
 }
 
 void Renderer::renderVideoPanel()
@@ -404,6 +461,8 @@ void Renderer::renderVideoPanel()
 	if (videoPanel.scale * videoPanel.textureHeight > windowHeight)
 		videoPanel.scale = windowHeight / videoPanel.textureHeight;
 
+	updateVideoFrameSize();
+
 	videoPanel.vertexMatrix.translate(videoPanel.offsetX, videoPanel.offsetY); // window coordinate units
 	videoPanel.vertexMatrix.translate( // scaled map pixel units
 		videoPanel.x + videoPanel.userX + videoStabilizer->getX() * videoPanel.textureWidth * videoPanel.scale * videoPanel.userScale,
@@ -443,6 +502,22 @@ void Renderer::renderVideoPanel()
 	glDisable(GL_SCISSOR_TEST);
 }
 
+void Renderer::updateVideoFrameSize()
+{
+	int targetWidth = (int)videoPanel.textureWidth;
+
+	// there is no need to decode more pixels than what ends up on the screen, plus a margin for the resampling
+	if (isEncoding ? enableDisplaySizeDecodingWhenEncoding : enableDisplaySizeDecoding)
+		targetWidth = std::min(targetWidth, (int)ceil(videoPanel.textureWidth * videoPanel.scale * videoPanel.userScale * displaySizeMargin));
+
+	// grow with some headroom and shrink only when clearly too large, so that zooming does not rebuild the converter on every frame
+	if (targetWidth > requestedVideoFrameWidth || targetWidth < requestedVideoFrameWidth / 2)
+	{
+		requestedVideoFrameWidth = std::min((int)videoPanel.textureWidth, targetWidth * 5 / 4);
+		videoDecoder->setTargetFrameSize(requestedVideoFrameWidth, (int)(requestedVideoFrameWidth * videoPanel.textureHeight / videoPanel.textureWidth + 0.5));
+	}
+}
+
 void Renderer::renderMapPanel()
 {
 	mapPanel.vertexMatrix.setToIdentity();
@@ -487,6 +562,67 @@ void Renderer::renderMapPanel()
 	glDisable(GL_SCISSOR_TEST);
 }
 
+void Renderer::createVideoTextures(int width, int height, int chromaWidth, int chromaHeight)
+{
+	deleteVideoTextures();
+
+	videoPanel.textureDataWidth = width;
+	videoPanel.textureDataHeight = height;
+	videoPanel.texelWidth = 1.0 / width;
+	videoPanel.texelHeight = 1.0 / height;
+
+	videoPanel.texture = new QOpenGLTexture(QOpenGLTexture::Target2D);
+	videoPanel.texture->create();
+	videoPanel.texture->bind();
+	videoPanel.texture->setSize(width, height);
+	videoPanel.texture->setFormat(isYuvVideo ? QOpenGLTexture::R8_UNorm : QOpenGLTexture::RGBA8_UNorm);
+	videoPanel.texture->setMinificationFilter(QOpenGLTexture::Linear);
+	videoPanel.texture->setMagnificationFilter(QOpenGLTexture::Linear);
+	videoPanel.texture->setWrapMode(QOpenGLTexture::ClampToEdge);
+	videoPanel.texture->allocateStorage();
+	videoPanel.texture->release();
+
+	if (isYuvVideo)
+	{
+		videoPanel.textureU = new QOpenGLTexture(QOpenGLTexture::Target2D);
+		videoPanel.textureV = new QOpenGLTexture(QOpenGLTexture::Target2D);
+
+		for (QOpenGLTexture* texture : { videoPanel.textureU, videoPanel.textureV })
+		{
+			texture->create();
+			texture->bind();
+			texture->setSize(chromaWidth, chromaHeight);
+			texture->setFormat(QOpenGLTexture::R8_UNorm);
+			texture->setMinificationFilter(QOpenGLTexture::Linear);
+			texture->setMagnificationFilter(QOpenGLTexture::Linear);
+			texture->setWrapMode(QOpenGLTexture::ClampToEdge);
+			texture->allocateStorage();
+			texture->release();
+		}
+	}
+}
+
+void Renderer::deleteVideoTextures()
+{
+	if (videoPanel.textureV != nullptr)
+	{
+		delete videoPanel.textureV;
+		videoPanel.textureV = nullptr;
+	}
+
+	if (videoPanel.textureU != nullptr)
+	{
+		delete videoPanel.textureU;
+		videoPanel.textureU = nullptr;
+	}
+
+	if (videoPanel.texture != nullptr)
+	{
+		delete videoPanel.texture;
+		videoPanel.texture = nullptr;
+	}
+}
+
 void Renderer::renderPanel(const Panel& panel)
 {
 	panel.program->bind();
@@ -498,10 +634,10 @@ void Renderer::renderPanel(const Panel& panel)
 		panel.program->setUniformValue((GLuint)panel.textureSamplerUniform, 0);
 
 	if (panel.textureWidthUniform >= 0)
-		panel.program->setUniformValue((GLuint)panel.textureWidthUniform, (float)panel.textureWidth);
+		panel.program->setUniformValue((GLuint)panel.textureWidthUniform, (float)panel.textureDataWidth);
 
 	if (panel.textureHeightUniform >= 0)
-		panel.program->setUniformValue((GLuint)panel.textureHeightUniform, (float)panel.textureHeight);
+		panel.program->setUniformValue((GLuint)panel.textureHeightUniform, (float)panel.textureDataHeight);
 
 	if (panel.texelWidthUniform >= 0)
 		panel.program->setUniformValue((GLuint)panel.texelWidthUniform, (float)panel.texelWidth);
@@ -509,9 +645,24 @@ void Renderer::renderPanel(const Panel& panel)
 	if (panel.texelHeightUniform >= 0)
 		panel.program->setUniformValue((GLuint)panel.texelHeightUniform, (float)panel.texelHeight);
 
+	if (panel.textureSamplerUUniform >= 0)
+		panel.program->setUniformValue((GLuint)panel.textureSamplerUUniform, 1);
+
+	if (panel.textureSamplerVUniform >= 0)
+		panel.program->setUniformValue((GLuint)panel.textureSamplerVUniform, 2);
+
+	if (panel.yuvToRgbMatrixUniform >= 0)
+		panel.program->setUniformValue((GLuint)panel.yuvToRgbMatrixUniform, panel.yuvToRgbMatrix);
+
 	panel.buffer->bind();
 	panel.texture->bind();
 
+	if (panel.textureU != nullptr && panel.textureV != nullptr)
+	{
+		panel.textureU->bind(1, QOpenGLTexture::ResetTextureUnit);
+		panel.textureV->bind(2, QOpenGLTexture::ResetTextureUnit);
+	}
+
 	int* textureCoordinateOffset = (int*)(sizeof(GLfloat) * 12);
 
 	glEnableVertexAttribArray(0);
@@ -522,6 +673,12 @@ void Renderer::renderPanel(const Panel& panel)
 	glDisableVertexAttribArray(0);
 	glDisableVertexAttribArray(1);
 
+	if (panel.textureU != nullptr && panel.textureV != nullptr)
+	{
+		panel.textureV->release(2, QOpenGLTexture::ResetTextureUnit);
+		panel.textureU->release(1, QOpenGLTexture::ResetTextureUnit);
+	}
+
 	panel.texture->release();
 	panel.buffer->release();
 	panel.program->release();
@@ -630,7 +787,7 @@ void Renderer::renderInfoPanel()
 	int rightPartMargin = 15;
 	int backgroundRadius = 10;
 	int backgroundWidth = textX + backgroundRadius + lineWidth1 + rightPartMargin + lineWidth2 + 10;
-	int backgroundHeight = lineSpacing * 19 + textY + 3;
+	int backgroundHeight = lineSpacing * 20 + textY + 3;
 
 	QColor textColor = QColor(255, 255, 255, 200);
 	QColor textGreenColor = QColor(0, 255, 0, 200);
@@ -653,6 +810,7 @@ void Renderer::renderInfoPanel()
 	painter->drawText(textX, textY += lineSpacing, lineWidth1, lineHeight, 0, "fps:");
 	painter->drawText(textX, textY += lineSpacing, lineWidth1, lineHeight, 0, "frame:");
 	painter->drawText(textX, textY += lineSpacing, lineWidth1, lineHeight, 0, "decode:");
+	painter->drawText(textX, textY += lineSpacing, lineWidth1, lineHeight, 0, "read:");
 	painter->drawText(textX, textY += lineSpacing, lineWidth1, lineHeight, 0, "stabilize:");
 	painter->drawText(textX, textY += lineSpacing, lineWidth1, lineHeight, 0, "render:");
 
@@ -688,6 +846,7 @@ void Renderer::renderInfoPanel()
 	painter->drawText(textX, textY += lineSpacing, lineWidth2, lineHeight, 0, QString::number(averageFps.getAverage(), 'f', 2));
 	painter->drawText(textX, textY += lineSpacing, lineWidth2, lineHeight, 0, QString("%1 ms").arg(QString::number(averageFrameTime.getAverage(), 'f', 2)));
 	painter->drawText(textX, textY += lineSpacing, lineWidth2, lineHeight, 0, QString("%1 ms").arg(QString::number(averageDecodeTime.getAverage(), 'f', 2)));
+	painter->drawText(textX, textY += lineSpacing, lineWidth2, lineHeight, 0, QString("%1 MB/s").arg(QString::number(videoDecoder->getReadThroughput(), 'f', 1)));
 	painter->drawText(textX, textY += lineSpacing, lineWidth2, lineHeight, 0, QString("%1 ms").arg(QString::number(averageStabilizeTime.getAverage(), 'f', 2)));
 	painter->drawText(textX, textY += lineSpacing, lineWidth2, lineHeight, 0, QString("%1 ms").arg(QString::number(averageRenderTime.getAverage(), 'f', 2)));
 
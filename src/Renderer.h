@@ -32,8 +32,11 @@ namespace OrientView
 		QOpenGLShaderProgram* program = nullptr;
 		QOpenGLBuffer* buffer = nullptr;
 		QOpenGLTexture* texture = nullptr;
+		QOpenGLTexture* textureU = nullptr; // only used with planar YUV input
+		QOpenGLTexture* textureV = nullptr; // only used with planar YUV input
 
 		QMatrix4x4 vertexMatrix;
+		QMatrix4x4 yuvToRgbMatrix;
 
 		QColor clearColor = QColor(0, 0, 0);
 		bool clippingEnabled = true;
@@ -50,8 +53,10 @@ namespace OrientView
 		double offsetX = 0.0;
 		double offsetY = 0.0;
 
-		double textureWidth = 0.0;
+		double textureWidth = 0.0; // size of the panel in full resolution texture pixels
 		double textureHeight = 0.0;
+		double textureDataWidth = 0.0; // size of the uploaded texture, can be smaller than the full resolution
+		double textureDataHeight = 0.0;
 		double texelWidth = 0.0;
 		double texelHeight = 0.0;
 
@@ -65,6 +70,9 @@ namespace OrientView
 		int textureHeightUniform = 0;
 		int texelWidthUniform = 0;
 		int texelHeightUniform = 0;
+		int textureSamplerUUniform = 0;
+		int textureSamplerVUniform = 0;
+		int yuvToRgbMatrixUniform = 0;
 	};
 
 	// Does the actual drawing using OpenGL.
@@ -81,7 +89,7 @@ namespace OrientView
 		void uploadFrameData(const FrameData& frameData);
 		void renderAll();
 		void stopRendering();
-		FrameData getRenderedFrame();
+		void getRenderedFrame(FrameData& frameData);
 
 		Panel& getVideoPanel();
 		Panel& getMapPanel();
@@ -95,22 +103,31 @@ namespace OrientView
 
 	private:
 
-		bool loadShaders(Panel& panel, const QString& shaderName);
+		bool loadShaders(Panel& panel, const QString& shaderName, bool isYuvInput);
 		void loadBuffer(Panel& panel, GLfloat* buffer, size_t size);
+		void createVideoTextures(int width, int height, int chromaWidth, int chromaHeight);
+		void deleteVideoTextures();
+		void updateVideoFrameSize();
 		void renderVideoPanel();
 		void renderMapPanel();
 		void renderPanel(const Panel& panel);
 		void renderRoute(const Route& route);
 		void renderInfoPanel();
 
+		VideoDecoder* videoDecoder = nullptr;
 		VideoStabilizer* videoStabilizer = nullptr;
 		InputHandler* inputHandler = nullptr;
 		RouteManager* routeManager = nullptr;
 
 		bool shouldFlipOutput = false;
+		bool enableDisplaySizeDecoding = false;
+		bool enableDisplaySizeDecodingWhenEncoding = false;
+		double displaySizeMargin = 1.0;
+		int requestedVideoFrameWidth = 0;
 		bool isEncoding = false;
 		bool showInfoPanel = false;
 		bool fullClearRequested = true;
+		bool isYuvVideo = false;
 
 		double windowWidth = 0.0;
 		double windowHeight = 0.0;
@@ -137,6 +154,5 @@ namespace OrientView
 
 		QOpenGLFramebufferObject* outputFramebuffer = nullptr;
 		QOpenGLFramebufferObject* outputFramebufferNonMultisample = nullptr;
-		FrameData renderedFrameData;
 	};
 }
@@ -52,18 +52,35 @@ void Settings::readFromQSettings(QSettings* settings)
 	video.inputVideoFilePath = settings->value("video/inputVideoFilePath", defaultSettings.video.inputVideoFilePath).toString();
 	video.startTimeOffset = settings->value("video/startTimeOffset", defaultSettings.video.startTimeOffset).toDouble();
 	video.seekToAnyFrame = settings->value("video/seekToAnyFrame", defaultSettings.video.seekToAnyFrame).toBool();
+	video.decoderThreadCount = settings->value("video/decoderThreadCount", defaultSettings.video.decoderThreadCount).toInt();
+	video.decoderThreadType = (VideoDecoderThreadType)settings->value("video/decoderThreadType", defaultSettings.video.decoderThreadType).toInt();
 	video.x = settings->value("video/x", defaultSettings.video.x).toDouble();
 	video.y = settings->value("video/y", defaultSettings.video.y).toDouble();
 	video.angle = settings->value("video/angle", defaultSettings.video.angle).toDouble();
 	video.scale = settings->value("video/scale", defaultSettings.video.scale).toDouble();
+	video.cropX = settings->value("video/cropX", defaultSettings.video.cropX).toInt();
+	video.cropY = settings->value("video/cropY", defaultSettings.video.cropY).toInt();
+	video.cropWidth = settings->value("video/cropWidth", defaultSettings.video.cropWidth).toInt();
+	video.cropHeight = settings->value("video/cropHeight", defaultSettings.video.cropHeight).toInt();
 	video.backgroundColor = settings->value("video/backgroundColor", defaultSettings.video.backgroundColor).value<QColor>();
 	video.rescaleShader = settings->value("video/rescaleShader", defaultSettings.video.rescaleShader).toString();
 	video.enableClipping = settings->value("video/enableClipping", defaultSettings.video.enableClipping).toBool();
 	video.enableClearing = settings->value("video/enableClearing", defaultSettings.video.enableClearing).toBool();
 	video.frameCountDivisor = settings->value("video/frameCountDivisor", defaultSettings.video.frameCountDivisor).toInt();
+	video.outputFrameRate = settings->value("video/outputFrameRate", defaultSettings.video.outputFrameRate).toDouble();
 	video.frameDurationDivisor = settings->value("video/frameDurationDivisor", defaultSettings.video.frameDurationDivisor).toInt();
 	video.frameSizeDivisor = settings->value("video/frameSizeDivisor", defaultSettings.video.frameSizeDivisor).toInt();
 	video.enableVerboseLogging = settings->value("video/enableVerboseLogging", defaultSettings.video.enableVerboseLogging).toBool();
+	video.frameQueueSize = settings->value("video/frameQueueSize", defaultSettings.video.frameQueueSize).toInt();
+	video.packetQueueSize = settings->value("video/packetQueueSize", defaultSettings.video.packetQueueSize).toInt();
+	video.readAheadSize = settings->value("video/readAheadSize", defaultSettings.video.readAheadSize).toInt();
+	video.useMemoryMapping = settings->value("video/useMemoryMapping", defaultSettings.video.useMemoryMapping).toBool();
+	video.enableYuvTextures = settings->value("video/enableYuvTextures", defaultSettings.video.enableYuvTextures).toBool();
+	video.frameCacheSize = settings->value("video/frameCacheSize", defaultSettings.video.frameCacheSize).toInt();
+	video.lookaheadMemorySize = settings->value("video/lookaheadMemorySize", defaultSettings.video.lookaheadMemorySize).toInt();
+	video.conversionThreadCount = settings->value("video/conversionThreadCount", defaultSettings.video.conversionThreadCount).toInt();
+	video.enableDisplaySizeDecoding = settings->value("video/enableDisplaySizeDecoding", defaultSettings.video.enableDisplaySizeDecoding).toBool();
+	video.displaySizeMargin = settings->value("video/displaySizeMargin", defaultSettings.video.displaySizeMargin).toDouble();
 
 	splits.type = (SplitTimeType)settings->value("splits/type", defaultSettings.splits.type).toInt();
 	splits.splitTimes = settings->value("splits/splitTimes", defaultSettings.splits.splitTimes).toString();
@@ -87,11 +104,24 @@ void Settings::readFromQSettings(QSettings* settings)
 	stabilizer.passTwoInputFilePath = settings->value("stabilizer/passTwoInputFilePath", defaultSettings.stabilizer.passTwoInputFilePath).toString();
 	stabilizer.passTwoOutputFilePath = settings->value("stabilizer/passTwoOutputFilePath", defaultSettings.stabilizer.passTwoOutputFilePath).toString();
 	stabilizer.smoothingRadius = settings->value("stabilizer/smoothingRadius", defaultSettings.stabilizer.smoothingRadius).toInt();
+	stabilizer.smoothingType = (StabilizerSmoothingType)settings->value("stabilizer/smoothingType", defaultSettings.stabilizer.smoothingType).toInt();
+	stabilizer.motionSource = (StabilizerMotionSource)settings->value("stabilizer/motionSource", defaultSettings.stabilizer.motionSource).toInt();
+	stabilizer.enableFastDecoding = settings->value("stabilizer/enableFastDecoding", defaultSettings.stabilizer.enableFastDecoding).toBool();
+	stabilizer.trackingThreadCount = settings->value("stabilizer/trackingThreadCount", defaultSettings.stabilizer.trackingThreadCount).toInt();
+	stabilizer.passOneSegmentCount = settings->value("stabilizer/passOneSegmentCount", defaultSettings.stabilizer.passOneSegmentCount).toInt();
+	stabilizer.motionEstimationInterval = settings->value("stabilizer/motionEstimationInterval", defaultSettings.stabilizer.motionEstimationInterval).toInt();
+	stabilizer.motionEstimationThreshold = settings->value("stabilizer/motionEstimationThreshold", defaultSettings.stabilizer.motionEstimationThreshold).toDouble();
+	stabilizer.gyroFieldOfView = settings->value("stabilizer/gyroFieldOfView", defaultSettings.stabilizer.gyroFieldOfView).toDouble();
+	stabilizer.gyroOrientation = settings->value("stabilizer/gyroOrientation", defaultSettings.stabilizer.gyroOrientation).toString();
+	stabilizer.gyroTimeOffset = settings->value("stabilizer/gyroTimeOffset", defaultSettings.stabilizer.gyroTimeOffset).toDouble();
 
 	encoder.outputVideoFilePath = settings->value("encoder/outputVideoFilePath", defaultSettings.encoder.outputVideoFilePath).toString();
 	encoder.preset = settings->value("encoder/preset", defaultSettings.encoder.preset).toString();
 	encoder.profile = settings->value("encoder/profile", defaultSettings.encoder.profile).toString();
 	encoder.constantRateFactor = settings->value("encoder/constantRateFactor", defaultSettings.encoder.constantRateFactor).toInt();
+	encoder.frameQueueSize = settings->value("encoder/frameQueueSize", defaultSettings.encoder.frameQueueSize).toInt();
+	encoder.conversionThreadCount = settings->value("encoder/conversionThreadCount", defaultSettings.encoder.conversionThreadCount).toInt();
+	encoder.enableDisplaySizeDecoding = settings->value("encoder/enableDisplaySizeDecoding", defaultSettings.encoder.enableDisplaySizeDecoding).toBool();
 
 	inputHandler.smallSeekAmount = settings->value("inputHandler/smallSeekAmount", defaultSettings.inputHandler.smallSeekAmount).toDouble();
 	inputHandler.normalSeekAmount = settings->value("inputHandler/normalSeekAmount", defaultSettings.inputHandler.normalSeekAmount).toDouble();
@@ -156,18 +186,35 @@ void Settings::writeToQSettings(QSettings* settings)
 	settings->setValue("video/inputVideoFilePath", video.inputVideoFilePath);
 	settings->setValue("video/startTimeOffset", video.startTimeOffset);
 	settings->setValue("video/seekToAnyFrame", video.seekToAnyFrame);
+	settings->setValue("video/decoderThreadCount", video.decoderThreadCount);
+	settings->setValue("video/decoderThreadType", video.decoderThreadType);
 	settings->setValue("video/x", video.x);
 	settings->setValue("video/y", video.y);
 	settings->setValue("video/angle", video.angle);
 	settings->setValue("video/scale", video.scale);
+	settings->setValue("video/cropX", video.cropX);
+	settings->setValue("video/cropY", video.cropY);
+	settings->setValue("video/cropWidth", video.cropWidth);
+	settings->setValue("video/cropHeight", video.cropHeight);
 	settings->setValue("video/backgroundColor", video.backgroundColor);
 	settings->setValue("video/rescaleShader", video.rescaleShader);
 	settings->setValue("video/enableClipping", video.enableClipping);
 	settings->setValue("video/enableClearing", video.enableClearing);
 	settings->setValue("video/frameCountDivisor", video.frameCountDivisor);
+	settings->setValue("video/outputFrameRate", video.outputFrameRate);
 	settings->setValue("video/frameDurationDivisor", video.frameDurationDivisor);
 	settings->setValue("video/frameSizeDivisor", video.frameSizeDivisor);
 	settings->setValue("video/enableVerboseLogging", video.enableVerboseLogging);
+	settings->setValue("video/frameQueueSize", video.frameQueueSize);
+	settings->setValue("video/packetQueueSize", video.packetQueueSize);
+	settings->setValue("video/readAheadSize", video.readAheadSize);
+	settings->setValue("video/useMemoryMapping", video.useMemoryMapping);
+	settings->setValue("video/enableYuvTextures", video.enableYuvTextures);
+	settings->setValue("video/frameCacheSize", video.frameCacheSize);
+	settings->setValue("video/lookaheadMemorySize", video.lookaheadMemorySize);
+	settings->setValue("video/conversionThreadCount", video.conversionThreadCount);
+	settings->setValue("video/enableDisplaySizeDecoding", video.enableDisplaySizeDecoding);
+	settings->setValue("video/displaySizeMargin", video.displaySizeMargin);
 
 	settings->setValue("splits/type", splits.type);
 	settings->setValue("splits/splitTimes", splits.splitTimes);
@@ -191,11 +238,24 @@ void Settings::writeToQSettings(QSettings* settings)
 	settings->setValue("stabilizer/passTwoInputFilePath", stabilizer.passTwoInputFilePath);
 	settings->setValue("stabilizer/passTwoOutputFilePath", stabilizer.passTwoOutputFilePath);
 	settings->setValue("stabilizer/smoothingRadius", stabilizer.smoothingRadius);
+	settings->setValue("stabilizer/smoothingType", stabilizer.smoothingType);
+	settings->setValue("stabilizer/motionSource", stabilizer.motionSource);
+	settings->setValue("stabilizer/enableFastDecoding", stabilizer.enableFastDecoding);
+	settings->setValue("stabilizer/trackingThreadCount", stabilizer.trackingThreadCount);
+	settings->setValue("stabilizer/passOneSegmentCount", stabilizer.passOneSegmentCount);
+	settings->setValue("stabilizer/motionEstimationInterval", stabilizer.motionEstimationInterval);
+	settings->setValue("stabilizer/motionEstimationThreshold", stabilizer.motionEstimationThreshold);
+	settings->setValue("stabilizer/gyroFieldOfView", stabilizer.gyroFieldOfView);
+	settings->setValue("stabilizer/gyroOrientation", stabilizer.gyroOrientation);
+	settings->setValue("stabilizer/gyroTimeOffset", stabilizer.gyroTimeOffset);
 
 	settings->setValue("encoder/outputVideoFilePath", encoder.outputVideoFilePath);
 	settings->setValue("encoder/preset", encoder.preset);
 	settings->setValue("encoder/profile", encoder.profile);
 	settings->setValue("encoder/constantRateFactor", encoder.constantRateFactor);
+	settings->setValue("encoder/frameQueueSize", encoder.frameQueueSize);
+	settings->setValue("encoder/conversionThreadCount", encoder.conversionThreadCount);
+	settings->setValue("encoder/enableDisplaySizeDecoding", encoder.enableDisplaySizeDecoding);
 
 	settings->setValue("inputHandler/smallSeekAmount", inputHandler.smallSeekAmount);
 	settings->setValue("inputHandler/normalSeekAmount", inputHandler.normalSeekAmount);
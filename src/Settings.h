@@ -10,6 +10,7 @@
 #include "RouteManager.h"
 #include "SplitTimeManager.h"
 #include "VideoStabilizer.h"
+#include "VideoDecoder.h"
 
 namespace Ui
 {
@@ -73,21 +74,38 @@ namespace OrientView
 
 		struct Video
 		{
-			QString inputVideoFilePath = "";
+			QString inputVideoFilePath = ""; // multiple files separated by "|" are played back one after the other
 			double startTimeOffset = 0.0;
 			bool seekToAnyFrame = false;
+			int decoderThreadCount = 0; // zero means one thread per core
+			VideoDecoderThreadType decoderThreadType = VideoDecoderThreadType::Automatic;
 			double x = 0.0;
 			double y = 0.0;
 			double angle = 0.0;
 			double scale = 1.0;
+			int cropX = 0; // source pixels
+			int cropY = 0; // source pixels
+			int cropWidth = 0; // source pixels, zero means no cropping
+			int cropHeight = 0; // source pixels, zero means no cropping
 			QColor backgroundColor = QColor(0, 50, 0, 255);
 			QString rescaleShader = "legacy";
 			bool enableClipping = true;
 			bool enableClearing = true;
 			int frameCountDivisor = 1;
+			double outputFrameRate = 0.0; // zero means the source frame rate divided by the frame count divisor
 			int frameDurationDivisor = 1;
 			int frameSizeDivisor = 1;
 			bool enableVerboseLogging = false;
+			int frameQueueSize = 4;
+			int packetQueueSize = 32; // megabytes
+			int readAheadSize = 64; // megabytes, zero means reading through the FFmpeg file protocol
+			bool useMemoryMapping = false;
+			bool enableYuvTextures = false;
+			int frameCacheSize = 256; // megabytes
+			int lookaheadMemorySize = 2048; // megabytes, the most the export may hold back for the lookahead stabilization
+			int conversionThreadCount = 0; // zero means one thread per core
+			bool enableDisplaySizeDecoding = true; // scale the decoded frames to the size they are shown at
+			double displaySizeMargin = 1.25; // decoded size relative to the shown size
 
 		} video;
 
@@ -123,6 +141,16 @@ namespace OrientView
 			QString passTwoInputFilePath = "";
 			QString passTwoOutputFilePath = "";
 			int smoothingRadius = 30;
+			StabilizerSmoothingType smoothingType = StabilizerSmoothingType::WindowAverage;
+			StabilizerMotionSource motionSource = StabilizerMotionSource::OpticalFlow; // the motion vectors of the decoder are used when available, with optical flow on the intra frames; phase correlation only measures the translation but is the fastest to calculate
+			bool enableFastDecoding = true; // lower quality decoding for the preprocessing
+			int trackingThreadCount = 0; // zero means one thread per core
+			int passOneSegmentCount = 0; // pass one is run in this many parts in parallel, zero means one per core
+			int motionEstimationInterval = 1; // the motion is estimated on every this many frames, the frames in between are interpolated
+			double motionEstimationThreshold = 0.0; // the motion is estimated sooner if the predicted movement gets larger than this (relative to the frame size), zero disables
+			double gyroFieldOfView = 118.0; // horizontal field of view of the lens in degrees, the gyro angles are turned to image distances with it
+			QString gyroOrientation = ""; // camera axes of the gyro channels (e.g. "ZXY", lower case means reversed), empty means the one given in the file
+			double gyroTimeOffset = 0.0; // seconds the telemetry is ahead of the video
 
 		} stabilizer;
 
@@ -132,6 +160,9 @@ namespace OrientView
 			QString preset = "veryfast";
 			QString profile = "high";
 			int constantRateFactor = 23;
+			int frameQueueSize = 4;
+			int conversionThreadCount = 0; // zero means one thread per core
+			bool enableDisplaySizeDecoding = false; // exported videos use the full decoded size by default
 
 		} encoder;
 
@@ -0,0 +1,223 @@
+// Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: GPLv3, see the LICENSE file.
+
+#include <algorithm>
+#include <cstring>
+
+#include <QFileInfo>
+#include <QStringList>
+
+#include "StabilizationDataFile.h"
+#include "VideoStabilizer.h"
+
+using namespace OrientView;
+
+namespace
+{
+	const char fileMagic[8] = { 'O', 'V', 'S', 'T', 'A', 'B', '\0', '\0' };
+	const uint32_t fileVersion = 1;
+
+	static_assert(sizeof(StabilizationDataHeader) % 8 == 0, "the frame positions after the header have to stay aligned");
+	static_assert(sizeof(FramePosition) == 32, "the frame position layout is part of the file format");
+}
+
+StabilizationDataFile::~StabilizationDataFile()
+{
+	close();
+}
+
+// The identity of the source video, so the data can be matched to the video it was made from.
+StabilizationDataHeader StabilizationDataFile::getSourceHeader(const QString& inputVideoFilePath, int64_t frameRateNum, int64_t frameRateDen)
+{
+	StabilizationDataHeader sourceHeader;
+	memset(&sourceHeader, 0, sizeof(sourceHeader));
+
+	QStringList fileNames;
+
+	for (const QString& filePath : inputVideoFilePath.split('|', QString::SkipEmptyParts))
+	{
+		QFileInfo fileInfo(filePath);
+
+		fileNames.append(fileInfo.fileName());
+		sourceHeader.sourceFileSize += fileInfo.size();
+	}
+
+	QByteArray sourceFileName = fileNames.join("|").toUtf8().left((int)sizeof(sourceHeader.sourceFileName) - 1);
+	memcpy(sourceHeader.sourceFileName, sourceFileName.constData(), (size_t)sourceFileName.size());
+
+	sourceHeader.frameRateNum = frameRateNum;
+	sourceHeader.frameRateDen = frameRateDen;
+
+	return sourceHeader;
+}
+
+bool StabilizationDataFile::isBinaryFile(const QString& fileName)
+{
+	QFile file(fileName);
+	char magic[sizeof(fileMagic)];
+
+	if (!file.open(QIODevice::ReadOnly) || file.read(magic, sizeof(magic)) != (qint64)sizeof(magic))
+		return false;
+
+	return (memcmp(magic, fileMagic, sizeof(magic)) == 0);
+}
+
+bool StabilizationDataFile::isCsvFileName(const QString& fileName)
+{
+	return (QFileInfo(fileName).suffix().compare("csv", Qt::CaseInsensitive) == 0);
+}
+
+// The header is written again with the final frame position count when finishing.
+bool StabilizationDataFile::create(const QString& fileName, StabilizationDataType type, const StabilizationDataHeader& sourceHeader)
+{
+	close();
+
+	header = sourceHeader;
+	memcpy(header.magic, fileMagic, sizeof(header.magic));
+	header.version = fileVersion;
+	header.type = (uint32_t)type;
+	header.framePositionCount = 0;
+
+	file.setFileName(fileName);
+
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+	{
+		qWarning("Could not create stabilization data file: %s", qPrintable(file.errorString()));
+		return false;
+	}
+
+	if (file.write((const char*)&header, sizeof(header)) != (qint64)sizeof(header))
+	{
+		qWarning("Could not write stabilization data file: %s", qPrintable(file.errorString()));
+		return false;
+	}
+
+	return true;
+}
+
+bool StabilizationDataFile::write(const FramePosition& framePosition)
+{
+	if (file.write((const char*)&framePosition, sizeof(framePosition)) != (qint64)sizeof(framePosition))
+	{
+		qWarning("Could not write stabilization data file: %s", qPrintable(file.errorString()));
+		return false;
+	}
+
+	header.framePositionCount++;
+
+	return true;
+}
+
+bool StabilizationDataFile::finish()
+{
+	bool result = file.seek(0) && (file.write((const char*)&header, sizeof(header)) == (qint64)sizeof(header));
+
+	if (!result)
+		qWarning("Could not write stabilization data file: %s", qPrintable(file.errorString()));
+
+	close();
+
+	return result;
+}
+
+// Removes a file that could not be written to the end, so it is not mistaken for a complete one.
+void StabilizationDataFile::discard()
+{
+	close();
+
+	if (!file.fileName().isEmpty())
+		file.remove();
+}
+
+bool StabilizationDataFile::open(const QString& fileName, StabilizationDataType type)
+{
+	close();
+
+	file.setFileName(fileName);
+
+	if (!file.open(QIODevice::ReadOnly))
+	{
+		qWarning("Could not open stabilization data file: %s", qPrintable(file.errorString()));
+		return false;
+	}
+
+	if (file.read((char*)&header, sizeof(header)) != (qint64)sizeof(header) || memcmp(header.magic, fileMagic, sizeof(header.magic)) != 0)
+	{
+		qWarning("Stabilization data file is not valid");
+		return false;
+	}
+
+	if (header.version != fileVersion)
+	{
+		qWarning("Stabilization data file version %u is not supported", header.version);
+		return false;
+	}
+
+	if (header.type != (uint32_t)type)
+	{
+		qWarning("Stabilization data file has the wrong type of data");
+		return false;
+	}
+
+	// a file which was not finished has the records but not the count
+	qint64 fileSize = file.size();
+	size_t recordCount = (size_t)((fileSize - (qint64)sizeof(header)) / (qint64)sizeof(FramePosition));
+
+	if (header.framePositionCount == 0 || header.framePositionCount > recordCount)
+		header.framePositionCount = recordCount;
+
+	framePositionCount = (size_t)header.framePositionCount;
+
+	if (framePositionCount == 0)
+		return true;
+
+	mappedData = file.map(0, fileSize);
+
+	if (mappedData == nullptr)
+	{
+		qWarning("Could not memory map the stabilization data file: %s", qPrintable(file.errorString()));
+		framePositionCount = 0;
+		return false;
+	}
+
+	framePositions = (const FramePosition*)(mappedData + sizeof(header));
+
+	return true;
+}
+
+bool StabilizationDataFile::isFromSource(const QString& inputVideoFilePath) const
+{
+	StabilizationDataHeader sourceHeader = getSourceHeader(inputVideoFilePath, 0, 0);
+
+	return (header.sourceFileSize == sourceHeader.sourceFileSize && strncmp(header.sourceFileName, sourceHeader.sourceFileName, sizeof(header.sourceFileName)) == 0);
+}
+
+const StabilizationDataHeader& StabilizationDataFile::getHeader() const
+{
+	return header;
+}
+
+const FramePosition* StabilizationDataFile::getFramePositions() const
+{
+	return framePositions;
+}
+
+size_t StabilizationDataFile::getFramePositionCount() const
+{
+	return framePositionCount;
+}
+
+void StabilizationDataFile::close()
+{
+	if (mappedData != nullptr)
+	{
+		file.unmap(mappedData);
+		mappedData = nullptr;
+	}
+
+	framePositions = nullptr;
+	framePositionCount = 0;
+
+	if (file.isOpen())
+		file.close();
+}
@@ -0,0 +1,64 @@
+// Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: GPLv3, see the LICENSE file.
+
+#pragma once
+
+#include <cstdint>
+
+#include <QFile>
+#include <QString>
+
+namespace OrientView
+{
+	struct FramePosition;
+
+	enum StabilizationDataType { CumulativeFramePositions = 1, NormalizedFramePositions = 2 };
+
+	// The start of a binary stabilization data file. The frame positions follow right after it, in the same layout as in memory.
+	struct StabilizationDataHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t type;
+		uint64_t framePositionCount;
+		int64_t frameRateNum;
+		int64_t frameRateDen;
+		int64_t sourceFileSize; // bytes, all the input video files together
+		char sourceFileName[256]; // UTF-8 file names of the input video files without the directories, separated by "|"
+	};
+
+	// Write the stabilization data of the preprocessing passes as it comes and read it back through a memory mapping.
+	class StabilizationDataFile
+	{
+
+	public:
+
+		~StabilizationDataFile();
+
+		static StabilizationDataHeader getSourceHeader(const QString& inputVideoFilePath, int64_t frameRateNum, int64_t frameRateDen);
+		static bool isBinaryFile(const QString& fileName);
+		static bool isCsvFileName(const QString& fileName);
+
+		bool create(const QString& fileName, StabilizationDataType type, const StabilizationDataHeader& sourceHeader);
+		bool write(const FramePosition& framePosition);
+		bool finish();
+		void discard();
+
+		bool open(const QString& fileName, StabilizationDataType type);
+		bool isFromSource(const QString& inputVideoFilePath) const;
+
+		const StabilizationDataHeader& getHeader() const;
+		const FramePosition* getFramePositions() const;
+		size_t getFramePositionCount() const;
+
+	private:
+
+		void close();
+
+		QFile file;
+		StabilizationDataHeader header = StabilizationDataHeader();
+		uchar* mappedData = nullptr;
+		const FramePosition* framePositions = nullptr;
+		size_t framePositionCount = 0;
+	};
+}
@@ -5,6 +5,7 @@
 #include <QFileInfo>
 #include <QUrl>
 #include <QDesktopServices>
+#include <QMessageBox>
 
 #include "StabilizeWindow.h"
 #include "ui_StabilizeWindow.h"
@@ -76,6 +77,14 @@ void StabilizeWindow::processingFinished()
 	isRunning = false;
 }
 
+void StabilizeWindow::processingFailed(const QString& message)
+{
+	ui->pushButtonStopClose->setText("Close");
+	isRunning = false;
+
+	QMessageBox::critical(this, "OrientView - Error", QString("%1.\n\nCheck the application log for details.").arg(message), QMessageBox::Ok);
+}
+
 void StabilizeWindow::on_pushButtonStopClose_clicked()
 {
 	if (isRunning)
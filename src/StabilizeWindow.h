@@ -36,6 +36,7 @@ namespace OrientView
 
 		void frameProcessed(int frameNumber);
 		void processingFinished();
+		void processingFailed(const QString& message);
 
 		private slots:
 
@@ -1,15 +1,23 @@
 // Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
 // License: GPLv3, see the LICENSE file.
 
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
 #include <QtGlobal>
+#include <QStringList>
 
 extern "C"
 {
 #define __STDC_CONSTANT_MACROS
 #include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
 }
 
 #include "VideoDecoder.h"
+#include "VideoDemuxerThread.h"
+#include "VideoInput.h"
 #include "Settings.h"
 #include "FrameData.h"
 
@@ -34,7 +42,7 @@ namespace
 			qDebug("%s", lineClipped);
 	}
 
-	bool openCodecContext(int* streamIndex, AVFormatContext* formatContext, AVMediaType mediaType)
+	bool openCodecContext(int* streamIndex, AVFormatContext* formatContext, AVMediaType mediaType, int threadCount, VideoDecoderThreadType threadType, VideoDecoderProfile profile, int lowres, bool exportMotionVectors)
 	{
 		*streamIndex = av_find_best_stream(formatContext, mediaType, -1, -1, nullptr, 0);
 
@@ -54,6 +62,29 @@ namespace
 				return false;
 			}
 
+			codecContext->thread_count = std::max(0, threadCount);
+
+			// trade image quality for speed when the frames are only analyzed
+			if (profile == VideoDecoderProfile::FastAnalysis)
+			{
+				codecContext->lowres = std::min(lowres, (int)codec->max_lowres);
+				codecContext->skip_loop_filter = AVDISCARD_ALL;
+				codecContext->skip_idct = AVDISCARD_BIDIR;
+				codecContext->flags2 |= CODEC_FLAG2_FAST;
+
+				qDebug("Using fast analysis decoding (lowres %d)", codecContext->lowres);
+			}
+
+			if (exportMotionVectors)
+				MotionVectorEstimator::enableExport(codecContext);
+
+			if (threadType == VideoDecoderThreadType::FrameThreading)
+				codecContext->thread_type = FF_THREAD_FRAME;
+			else if (threadType == VideoDecoderThreadType::SliceThreading)
+				codecContext->thread_type = FF_THREAD_SLICE;
+			else
+				codecContext->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+
 			AVDictionary* opts = nullptr;
 
 			if (avcodec_open2(codecContext, codec, &opts) < 0)
@@ -61,13 +92,41 @@ namespace
 				qWarning("Could not open %s codec", av_get_media_type_string(mediaType));
 				return false;
 			}
+
+			qDebug("Decoding %s with %d thread(s)", av_get_media_type_string(mediaType), codecContext->thread_count);
 		}
 
 		return true;
 	}
+
+	// planar formats that the renderer can upload as separate Y, U and V textures
+	bool isPlanarYuvFormat(AVPixelFormat pixelFormat)
+	{
+		return (pixelFormat == PIX_FMT_YUV420P || pixelFormat == PIX_FMT_YUVJ420P ||
+			pixelFormat == PIX_FMT_YUV422P || pixelFormat == PIX_FMT_YUVJ422P ||
+			pixelFormat == PIX_FMT_YUV444P || pixelFormat == PIX_FMT_YUVJ444P);
+	}
+
+	bool isJpegRangeFormat(AVPixelFormat pixelFormat)
+	{
+		return (pixelFormat == PIX_FMT_YUVJ420P || pixelFormat == PIX_FMT_YUVJ422P || pixelFormat == PIX_FMT_YUVJ444P);
+	}
+
+	// formats where the first plane is 8-bit luma with one byte per pixel (e.g. yuv420p and nv12)
+	bool hasLumaPlane(AVPixelFormat pixelFormat)
+	{
+		const AVPixFmtDescriptor* pixelFormatDescriptor = av_pix_fmt_desc_get(pixelFormat);
+
+		if (pixelFormatDescriptor == nullptr || (pixelFormatDescriptor->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_HWACCEL)))
+			return false;
+
+		const AVComponentDescriptor& luma = pixelFormatDescriptor->comp[0];
+
+		return (luma.plane == 0 && luma.step_minus1 == 0 && luma.offset_plus1 == 1 && luma.shift == 0 && luma.depth_minus1 == 7);
+	}
 }
 
-bool VideoDecoder::initialize(Settings* settings)
+bool VideoDecoder::initialize(Settings* settings, VideoDecoderProfile profile)
 {
 	qDebug("Initializing video decoder (%s)", qPrintable(settings->video.inputVideoFilePath));
 
@@ -78,19 +137,43 @@ bool VideoDecoder::initialize(Settings* settings)
 	av_log_set_callback(ffmpegLogCallback);
 	av_register_all();
 
-	if (avformat_open_input(&formatContext, settings->video.inputVideoFilePath.toUtf8().constData(), nullptr, nullptr) < 0)
+	// the parts of a recording split by the camera play back as one video
+	QStringList fileNames = settings->video.inputVideoFilePath.split('|', QString::SkipEmptyParts);
+
+	if (fileNames.isEmpty())
 	{
-		qWarning("Could not open source file");
+		qWarning("No source file given");
 		return false;
 	}
 
-	if (avformat_find_stream_info(formatContext, nullptr) < 0)
+	for (const QString& fileName : fileNames)
 	{
-		qWarning("Could not find stream information");
-		return false;
+		VideoInput* videoInput = new VideoInput();
+		videoInputs.push_back(videoInput);
+
+		if (!videoInput->initialize(fileName.trimmed(), settings))
+		{
+			qWarning("Could not open video input");
+			return false;
+		}
 	}
 
-	if (!openCodecContext(&videoStreamIndex, formatContext, AVMEDIA_TYPE_VIDEO))
+	// decode at the largest power of two reduction that the grayscale frame size divisor still divides evenly
+	int lowres = 0;
+
+	while (lowres < 3 && settings->stabilizer.frameSizeDivisor % (2 << lowres) == 0)
+		++lowres;
+
+	// the stabilizer can use the motion the decoder has already found instead of tracking the images
+	exportMotionVectors = (settings->stabilizer.motionSource == StabilizerMotionSource::MotionVectors);
+
+	if (exportMotionVectors && !MotionVectorEstimator::isSupported())
+	{
+		qWarning("This FFmpeg version cannot export motion vectors, using optical flow");
+		exportMotionVectors = false;
+	}
+
+	if (!openCodecContext(&videoStreamIndex, videoInputs[0]->getFormatContext(), AVMEDIA_TYPE_VIDEO, settings->video.decoderThreadCount, settings->video.decoderThreadType, profile, lowres, exportMotionVectors))
 	{
 		qWarning("Could not open video codec context");
 		return false;
@@ -108,36 +191,109 @@ bool VideoDecoder::initialize(Settings* settings)
 	packet.data = nullptr;
 	packet.size = 0;
 
-	videoStream = formatContext->streams[(size_t)videoStreamIndex];
+	videoStream = videoInputs[0]->getVideoStream();
 	videoCodecContext = videoStream->codec;
+	lowresShift = videoCodecContext->lowres;
 
-	frameWidth = videoCodecContext->width / settings->video.frameSizeDivisor;
-	frameHeight = videoCodecContext->height / settings->video.frameSizeDivisor;
+	// all the packets go through the codec of the first file
+	for (size_t i = 1; i < videoInputs.size(); ++i)
+	{
+		AVCodecContext* codecContext = videoInputs[i]->getVideoStream()->codec;
 
-	swsContext = sws_getContext(videoCodecContext->width, videoCodecContext->height, videoCodecContext->pix_fmt, frameWidth, frameHeight, PIX_FMT_RGBA, SWS_BILINEAR, nullptr, nullptr, nullptr);
+		if (codecContext->codec_id != videoCodecContext->codec_id || codecContext->width != videoCodecContext->width || codecContext->height != videoCodecContext->height || codecContext->pix_fmt != videoCodecContext->pix_fmt)
+		{
+			qWarning("Video file %s does not have the same format as the first one", qPrintable(videoInputs[i]->getFileName()));
+			return false;
+		}
 
-	if (!swsContext)
-	{
-		qWarning("Could not get sws context");
+		// the parameter sets (e.g. the SPS and PPS of H.264) can differ between recording settings with the same frame size
+		if (codecContext->extradata_size != videoCodecContext->extradata_size || (codecContext->extradata_size > 0 && memcmp(codecContext->extradata, videoCodecContext->extradata, (size_t)codecContext->extradata_size) != 0))
+		{
+			qWarning("Video file %s does not have the same codec parameters as the first one", qPrintable(videoInputs[i]->getFileName()));
+			return false;
+		}
+	}
+
+	if (!initializeCrop(settings))
 		return false;
+
+	frameWidth = sourceWidth / settings->video.frameSizeDivisor;
+	frameHeight = sourceHeight / settings->video.frameSizeDivisor;
+
+	isYuvOutput = settings->video.enableYuvTextures;
+
+	if (isYuvOutput)
+	{
+		AVPixelFormat sourcePixelFormat = videoCodecContext->pix_fmt;
+
+		// the planes can be copied as is if the renderer understands them and no scaling is needed
+		if (isPlanarYuvFormat(sourcePixelFormat) && frameWidth == sourceWidth && frameHeight == sourceHeight)
+		{
+			framePixelFormat = sourcePixelFormat;
+			useFrameCopy = true;
+		}
+		else
+			framePixelFormat = PIX_FMT_YUV420P;
+
+		const AVPixFmtDescriptor* pixelFormatDescriptor = av_pix_fmt_desc_get(framePixelFormat);
+		chromaFrameWidth = -((-frameWidth) >> pixelFormatDescriptor->log2_chroma_w);
+		chromaFrameHeight = -((-frameHeight) >> pixelFormatDescriptor->log2_chroma_h);
+
+		// sws expands the range only when converting from a yuvj format, otherwise the samples are passed through
+		isFullRange = isJpegRangeFormat(framePixelFormat) || (!isJpegRangeFormat(sourcePixelFormat) && videoCodecContext->color_range == AVCOL_RANGE_JPEG);
+		isBt709 = (videoCodecContext->colorspace == AVCOL_SPC_BT709) || (videoCodecContext->colorspace == AVCOL_SPC_UNSPECIFIED && videoCodecContext->height > 576);
+
+		qDebug("Using %s textures (%s, %s range)", av_get_pix_fmt_name(framePixelFormat), isBt709 ? "BT.709" : "BT.601", isFullRange ? "full" : "limited");
+	}
+	else
+		framePixelFormat = PIX_FMT_RGBA;
+
+	if (!useFrameCopy)
+	{
+		if (!frameConverter.initialize(sourceWidth, sourceHeight, videoCodecContext->pix_fmt, frameWidth, frameHeight, framePixelFormat, settings->video.conversionThreadCount))
+		{
+			qWarning("Could not initialize frame converter");
+			return false;
+		}
+
+		qDebug("Converting video frames in %d slice(s)", frameConverter.getSliceCount());
 	}
 
+	// the output follows the size the video is shown at, starting from the full size
+	conversionThreadCount = settings->video.conversionThreadCount;
+	outputFrameWidth = targetFrameWidth = frameWidth;
+	outputFrameHeight = targetFrameHeight = frameHeight;
+	outputChromaFrameWidth = chromaFrameWidth;
+	outputChromaFrameHeight = chromaFrameHeight;
+
 	convertedPicture = new AVPicture();
 
-	if (avpicture_alloc(convertedPicture, PIX_FMT_RGBA, frameWidth, frameHeight) < 0)
+	if (avpicture_alloc(convertedPicture, framePixelFormat, frameWidth, frameHeight) < 0)
 	{
 		qWarning("Could not allocate conversion picture");
 		return false;
 	}
 
-	grayscaleFrameWidth = videoCodecContext->width / settings->stabilizer.frameSizeDivisor;
-	grayscaleFrameHeight = videoCodecContext->height / settings->stabilizer.frameSizeDivisor;
+	// the stabilizer sees the same cropped region as the video panel, so its normalized coordinates stay relative to the crop
+	// lowres decoding has already done part of the reduction
+	int grayscaleFrameSizeDivisor = std::max(1, settings->stabilizer.frameSizeDivisor >> lowresShift);
+	grayscaleFrameWidth = sourceWidth / grayscaleFrameSizeDivisor;
+	grayscaleFrameHeight = sourceHeight / grayscaleFrameSizeDivisor;
 
-	swsContextGrayscale = sws_getContext(videoCodecContext->width, videoCodecContext->height, videoCodecContext->pix_fmt, grayscaleFrameWidth, grayscaleFrameHeight, PIX_FMT_GRAY8, SWS_BILINEAR, nullptr, nullptr, nullptr);
+	// the luma plane already is a grayscale image and only needs to be made smaller
+	useLumaDownscale = hasLumaPlane(videoCodecContext->pix_fmt) && grayscaleFrameSizeDivisor <= 256;
 
-	if (!swsContextGrayscale)
+	if (useLumaDownscale)
+	{
+		if (!boxDownscaler.initialize(grayscaleFrameWidth, grayscaleFrameHeight, grayscaleFrameSizeDivisor))
+		{
+			qWarning("Could not initialize grayscale box downscaler");
+			return false;
+		}
+	}
+	else if (!frameConverterGrayscale.initialize(sourceWidth, sourceHeight, videoCodecContext->pix_fmt, grayscaleFrameWidth, grayscaleFrameHeight, PIX_FMT_GRAY8, settings->video.conversionThreadCount))
 	{
-		qWarning("Could not get sws grayscale context");
+		qWarning("Could not initialize grayscale frame converter");
 		return false;
 	}
 
@@ -149,36 +305,108 @@ bool VideoDecoder::initialize(Settings* settings)
 		return false;
 	}
 
-	frameCountDivisor = settings->video.frameCountDivisor;
+	frameCountDivisor = std::max(1, settings->video.frameCountDivisor);
 	frameDurationDivisor = settings->video.frameDurationDivisor;
 
-	totalFrameCount = videoStream->nb_frames / frameCountDivisor;
+	AVRational sourceFrameRate = videoStream->avg_frame_rate;
+	AVRational outputFrameRate = sourceFrameRate;
+
+	// an explicit output frame rate overrides the frame count divisor
+	if (settings->video.outputFrameRate > 0.0)
+		outputFrameRate = av_d2q(settings->video.outputFrameRate, 1000000);
+	else
+		outputFrameRate.den *= frameCountDivisor;
+
+	av_reduce(&outputFrameRate.num, &outputFrameRate.den, outputFrameRate.num, outputFrameRate.den, INT_MAX);
+	isDecimating = (av_cmp_q(outputFrameRate, sourceFrameRate) < 0);
+
+	int64_t sourceFrameCount = 0;
+
+	for (VideoInput* videoInput : videoInputs)
+		sourceFrameCount += videoInput->getFrameCount();
 
-	frameRateNum = (int64_t)videoStream->avg_frame_rate.num / (int64_t)frameCountDivisor * (int64_t)frameDurationDivisor;
-	frameRateDen = (int64_t)videoStream->avg_frame_rate.den;
+	totalFrameCount = isDecimating ? av_rescale_q(sourceFrameCount, outputFrameRate, sourceFrameRate) : sourceFrameCount;
+
+	frameRateNum = (int64_t)(isDecimating ? outputFrameRate.num : sourceFrameRate.num) * (int64_t)frameDurationDivisor;
+	frameRateDen = (int64_t)(isDecimating ? outputFrameRate.den : sourceFrameRate.den);
 	frameDuration = frameRateDen * 1000000 / frameRateNum;
 
+	halfFrameInterval = av_rescale(sourceFrameRate.den, videoStream->time_base.den, (int64_t)sourceFrameRate.num * videoStream->time_base.num) / 2;
+	outputFrameInterval = (double)frameRateDen * frameDurationDivisor * videoStream->time_base.den / ((double)frameRateNum * videoStream->time_base.num);
+
+	motionVectorEstimator.initialize(cropX, cropY, sourceWidth, sourceHeight, lowresShift, halfFrameInterval * 2);
+
+	if (isDecimating)
+		qDebug("Decimating video from %.3f fps to %.3f fps", av_q2d(sourceFrameRate), av_q2d(outputFrameRate));
+
+	startTimestamp = (videoStream->start_time != AV_NOPTS_VALUE) ? videoStream->start_time : 0;
+	previousFrameTimestamp = startTimestamp;
+	nextOutputTimestamp = (double)startTimestamp;
+
+	// each file starts where the previous one ends, in the time base of the first file
+	int64_t inputStartTimestamp = startTimestamp;
+
+	for (size_t i = 0; i < videoInputs.size(); ++i)
+	{
+		videoInputs[i]->setTimeline(videoStream->time_base, inputStartTimestamp);
+
+		if (i + 1 < videoInputs.size())
+		{
+			if (videoInputs[i]->getDuration() == AV_NOPTS_VALUE)
+			{
+				qWarning("Could not find the duration of %s", qPrintable(videoInputs[i]->getFileName()));
+				return false;
+			}
+
+			inputStartTimestamp = videoInputs[i]->getEndTimestamp();
+		}
+	}
+
+	endTimestamp = videoInputs.back()->getEndTimestamp();
+
+	if (!buildKeyframeIndex())
+	{
+		qWarning("Could not build keyframe index");
+		return false;
+	}
+
+	videoDemuxerThread = new VideoDemuxerThread();
+
+	if (!videoDemuxerThread->initialize(videoInputs, settings))
+	{
+		qWarning("Could not initialize video demuxer thread");
+		return false;
+	}
+
+	videoDemuxerThread->start();
+
 	isInitialized = true;
 
 	if (settings->video.startTimeOffset > 0.0)
-		seekRelative(settings->video.startTimeOffset);
+		seekAbsolute(settings->video.startTimeOffset);
 
 	return true;
 }
 
 VideoDecoder::~VideoDecoder()
 {
+	if (videoDemuxerThread != nullptr)
+	{
+		videoDemuxerThread->stop();
+		delete videoDemuxerThread;
+		videoDemuxerThread = nullptr;
+	}
+
 	if (videoCodecContext != nullptr)
 	{
 		avcodec_close(videoCodecContext);
 		videoCodecContext = nullptr;
 	}
 
-	if (formatContext != nullptr)
-	{
-		avformat_close_input(&formatContext);
-		formatContext = nullptr;
-	}
+	for (VideoInput* videoInput : videoInputs)
+		delete videoInput;
+
+	videoInputs.clear();
 
 	if (frame != nullptr)
 	{
@@ -186,24 +414,12 @@ VideoDecoder::~VideoDecoder()
 		frame = nullptr;
 	}
 
-	if (swsContextGrayscale != nullptr)
-	{
-		sws_freeContext(swsContextGrayscale);
-		swsContextGrayscale = nullptr;
-	}
-
 	if (convertedPictureGrayscale != nullptr)
 	{
 		avpicture_free(convertedPictureGrayscale);
 		convertedPictureGrayscale = nullptr;
 	}
 
-	if (swsContext != nullptr)
-	{
-		sws_freeContext(swsContext);
-		swsContext = nullptr;
-	}
-
 	if (convertedPicture != nullptr)
 	{
 		avpicture_free(convertedPicture);
@@ -218,94 +434,136 @@ bool VideoDecoder::getNextFrame(FrameData* frameData, FrameData* frameDataGraysc
 	if (!isInitialized)
 		return false;
 
-	int framesRead = 0;
-	int readResult = 0;
-
 	decodeTimer.restart();
 
 	while (true)
 	{
-		if ((readResult = av_read_frame(formatContext, &packet)) >= 0)
+		// a seek may have already decoded the target frame
+		if (hasPendingFrame)
+			hasPendingFrame = false;
+		else if (!decodeNextPicture())
+			return false;
+
+		// the motion of the dropped frames adds up to the motion of the next output frame
+		if (exportMotionVectors && frameDataGrayscale != nullptr)
 		{
-			if (packet.stream_index == videoStreamIndex)
+			double deltaX = 0.0;
+			double deltaY = 0.0;
+			double deltaAngle = 0.0;
+
+			if (motionVectorEstimator.estimate(frame, deltaX, deltaY, deltaAngle))
 			{
-				int gotPicture = 0;
-				int decodedBytes = avcodec_decode_video2(videoCodecContext, frame, &gotPicture, &packet);
-
-				if (++framesRead < frameCountDivisor)
-				{
-					av_free_packet(&packet);
-					continue;
-				}
-
-				framesRead = 0;
-				cumulativeFrameNumber++;
-
-				if (decodedBytes < 0)
-				{
-					qWarning("Could not decode video frame");
-					av_free_packet(&packet);
-					return false;
-				}
-
-				if (gotPicture)
-				{
-					if (frameData != nullptr)
-					{
-						sws_scale(swsContext, frame->data, frame->linesize, 0, frame->height, convertedPicture->data, convertedPicture->linesize);
-
-						frameData->data = convertedPicture->data[0];
-						frameData->dataLength = (size_t)(frameHeight * convertedPicture->linesize[0]);
-						frameData->rowLength = (size_t)(convertedPicture->linesize[0]);
-						frameData->width = frameWidth;
-						frameData->height = frameHeight;
-						frameData->duration = av_rescale((frame->best_effort_timestamp - previousFrameTimestamp) * 1000000 / frameDurationDivisor, videoStream->time_base.num, videoStream->time_base.den);
-						frameData->timeStamp = frame->best_effort_timestamp;
-						frameData->cumulativeNumber = cumulativeFrameNumber;
-
-						if (frameData->duration <= 0 || frameData->duration > 1000000)
-							frameData->duration = frameDuration;
-					}
-
-					if (frameDataGrayscale != nullptr)
-					{
-						sws_scale(swsContextGrayscale, frame->data, frame->linesize, 0, frame->height, convertedPictureGrayscale->data, convertedPictureGrayscale->linesize);
-
-						frameDataGrayscale->data = convertedPictureGrayscale->data[0];
-						frameDataGrayscale->dataLength = (size_t)(grayscaleFrameHeight * convertedPictureGrayscale->linesize[0]);
-						frameDataGrayscale->rowLength = (size_t)(convertedPictureGrayscale->linesize[0]);
-						frameDataGrayscale->width = grayscaleFrameWidth;
-						frameDataGrayscale->height = grayscaleFrameHeight;
-						frameDataGrayscale->duration = (int)av_rescale((frame->best_effort_timestamp - previousFrameTimestamp) * 1000000 / frameDurationDivisor, videoStream->time_base.num, videoStream->time_base.den);
-						frameDataGrayscale->timeStamp = frame->best_effort_timestamp;
-						frameDataGrayscale->cumulativeNumber = cumulativeFrameNumber;
-
-						if (frameDataGrayscale->duration <= 0 || frameDataGrayscale->duration > 1000000)
-							frameDataGrayscale->duration = frameDuration;
-					}
-
-					double totalDurationInSeconds = ((double)videoStream->time_base.num / videoStream->time_base.den) * videoStream->duration;
-					currentTimeInSeconds = ((double)frame->best_effort_timestamp / videoStream->duration) * totalDurationInSeconds;
-					previousFrameTimestamp = frame->best_effort_timestamp;
-					lastDecodeTime = decodeTimer.nsecsElapsed() / 1000000.0;
-					isFinished = false;
-
-					av_free_packet(&packet);
-					return true;
-				}
+				motionX += deltaX;
+				motionY += deltaY;
+				motionAngle += deltaAngle;
 			}
+			else
+				isMotionValid = false;
+		}
 
-			av_free_packet(&packet);
+		if (isDecimating)
+		{
+			// drop the frames between the output times
+			if (frame->best_effort_timestamp < nextOutputTimestamp - halfFrameInterval)
+				continue;
+
+			nextOutputTimestamp += outputFrameInterval;
+
+			// start over after a gap in the time stamps
+			if (nextOutputTimestamp <= frame->best_effort_timestamp)
+				nextOutputTimestamp = frame->best_effort_timestamp + outputFrameInterval;
 		}
-		else
+
+		cumulativeFrameNumber++;
+
+		currentTimeInSeconds = getTimeFromTimestamp(frame->best_effort_timestamp);
+
+		// only the cropped region is converted
+		AVPicture sourcePicture;
+		getCroppedPicture(sourcePicture);
+
+		if (frameData != nullptr)
 		{
-			if (readResult != AVERROR_EOF)
-				qWarning("Could not read a frame: %d", readResult);
+			updateOutputFrameSize();
 
-			isFinished = true;
+			// convert directly to the buffer given by the caller if there is one
+			// the buffers are sized for the full frame, so the smaller outputs fit as well
+			AVPicture targetPicture;
+			avpicture_fill(&targetPicture, (frameData->data != nullptr) ? frameData->data : convertedPicture->data[0], framePixelFormat, outputFrameWidth, outputFrameHeight);
 
-			return false;
+			if (useFrameCopy)
+				av_picture_copy(&targetPicture, &sourcePicture, framePixelFormat, outputFrameWidth, outputFrameHeight);
+			else
+				frameConverter.convert(sourcePicture.data, sourcePicture.linesize, targetPicture.data, targetPicture.linesize);
+
+			frameData->data = targetPicture.data[0];
+			frameData->dataLength = (size_t)avpicture_get_size(framePixelFormat, outputFrameWidth, outputFrameHeight);
+			frameData->rowLength = (size_t)(targetPicture.linesize[0]);
+			frameData->width = outputFrameWidth;
+			frameData->height = outputFrameHeight;
+			frameData->chromaRowLength = (size_t)(targetPicture.linesize[1]);
+			frameData->chromaWidth = outputChromaFrameWidth;
+			frameData->chromaHeight = outputChromaFrameHeight;
+			frameData->duration = av_rescale((frame->best_effort_timestamp - previousFrameTimestamp) * 1000000 / frameDurationDivisor, videoStream->time_base.num, videoStream->time_base.den);
+			frameData->timeStamp = frame->best_effort_timestamp;
+			frameData->cumulativeNumber = cumulativeFrameNumber;
+			frameData->time = currentTimeInSeconds;
+
+			if (frameData->duration <= 0 || frameData->duration > 1000000)
+				frameData->duration = frameDuration;
 		}
+
+		if (frameDataGrayscale != nullptr)
+		{
+			AVPicture targetPicture = *convertedPictureGrayscale;
+
+			if (frameDataGrayscale->data != nullptr)
+				avpicture_fill(&targetPicture, frameDataGrayscale->data, PIX_FMT_GRAY8, grayscaleFrameWidth, grayscaleFrameHeight);
+
+			if (useLumaDownscale)
+				boxDownscaler.downscale(sourcePicture.data[0], sourcePicture.linesize[0], targetPicture.data[0], targetPicture.linesize[0]);
+			else
+				frameConverterGrayscale.convert(sourcePicture.data, sourcePicture.linesize, targetPicture.data, targetPicture.linesize);
+
+			frameDataGrayscale->data = targetPicture.data[0];
+			frameDataGrayscale->dataLength = (size_t)(grayscaleFrameHeight * targetPicture.linesize[0]);
+			frameDataGrayscale->rowLength = (size_t)(targetPicture.linesize[0]);
+			frameDataGrayscale->width = grayscaleFrameWidth;
+			frameDataGrayscale->height = grayscaleFrameHeight;
+			frameDataGrayscale->duration = (int)av_rescale((frame->best_effort_timestamp - previousFrameTimestamp) * 1000000 / frameDurationDivisor, videoStream->time_base.num, videoStream->time_base.den);
+			frameDataGrayscale->timeStamp = frame->best_effort_timestamp;
+			frameDataGrayscale->cumulativeNumber = cumulativeFrameNumber;
+			frameDataGrayscale->time = currentTimeInSeconds;
+
+			if (frameDataGrayscale->duration <= 0 || frameDataGrayscale->duration > 1000000)
+				frameDataGrayscale->duration = frameDuration;
+
+			frameDataGrayscale->hasMotion = exportMotionVectors && isMotionValid;
+			frameDataGrayscale->motionX = motionX;
+			frameDataGrayscale->motionY = motionY;
+			frameDataGrayscale->motionAngle = motionAngle;
+			frameDataGrayscale->hasNextMotion = false;
+
+			// the bidirectional frames and the next keyframe come without the motion
+			if (frameDataGrayscale->hasMotion && videoCodecContext->has_b_frames == 0)
+			{
+				int64_t nextFrameTimestamp = isDecimating ? (int64_t)nextOutputTimestamp : frame->best_effort_timestamp + halfFrameInterval * 2;
+				auto keyframe = std::upper_bound(keyframeTimestamps.begin(), keyframeTimestamps.end(), frame->best_effort_timestamp);
+
+				frameDataGrayscale->hasNextMotion = (keyframe == keyframeTimestamps.end() || *keyframe > nextFrameTimestamp + halfFrameInterval);
+			}
+
+			resetMotion();
+		}
+
+		previousFrameTimestamp = frame->best_effort_timestamp;
+		isFinished = false;
+
+		statusMutex.lock();
+		lastDecodeTime = decodeTimer.nsecsElapsed() / 1000000.0;
+		statusMutex.unlock();
+
+		return true;
 	}
 }
 
@@ -316,38 +574,330 @@ void VideoDecoder::seekRelative(double seconds)
 	if (!isInitialized)
 		return;
 
-	int64_t targetTimeStamp = previousFrameTimestamp + (int64_t)(((double)videoStream->time_base.den / videoStream->time_base.num) * seconds + 0.5);
-	targetTimeStamp = std::max((int64_t)0, std::min(targetTimeStamp, videoStream->duration));
+	seekToTimestamp(previousFrameTimestamp + getTimestampFromTime(seconds) - startTimestamp);
+}
+
+void VideoDecoder::seekAbsolute(double seconds)
+{
+	QMutexLocker locker(&decoderMutex);
+
+	if (!isInitialized)
+		return;
+
+	seekToTimestamp(getTimestampFromTime(seconds));
+}
+
+double VideoDecoder::getKeyframeTime(double seconds)
+{
+	QMutexLocker locker(&decoderMutex);
+
+	if (!isInitialized || keyframeTimestamps.empty())
+		return seconds;
+
+	auto keyframe = std::upper_bound(keyframeTimestamps.begin(), keyframeTimestamps.end(), getTimestampFromTime(seconds));
+
+	if (keyframe != keyframeTimestamps.begin())
+		--keyframe;
 
-	if (avformat_seek_file(formatContext, (int)videoStreamIndex, 0, targetTimeStamp, targetTimeStamp, (seekToAnyFrame ? AVSEEK_FLAG_ANY : 0)) >= 0)
+	return getTimeFromTimestamp(*keyframe);
+}
+
+// Can be called from any thread. The size is clamped to the full frame size and is used from the next decoded frame on.
+void VideoDecoder::setTargetFrameSize(int width, int height)
+{
+	QMutexLocker locker(&statusMutex);
+
+	targetFrameWidth = std::max(16, std::min(frameWidth, (width + 1) & ~1));
+	targetFrameHeight = std::max(16, std::min(frameHeight, (height + 1) & ~1));
+}
+
+// Can be called from any thread to abandon a seek that is still decoding towards its target.
+void VideoDecoder::setSeekCancelled(bool value)
+{
+	isSeekCancelled.store(value ? 1 : 0);
+}
+
+// Returns false if the crop does not fit in the frame or the pixel format cannot be cropped.
+bool VideoDecoder::initializeCrop(Settings* settings)
+{
+	sourceWidth = videoCodecContext->width;
+	sourceHeight = videoCodecContext->height;
+	cropX = 0;
+	cropY = 0;
+
+	if (settings->video.cropWidth <= 0 || settings->video.cropHeight <= 0)
+		return true;
+
+	const AVPixFmtDescriptor* pixelFormatDescriptor = av_pix_fmt_desc_get(videoCodecContext->pix_fmt);
+
+	if (pixelFormatDescriptor == nullptr || (pixelFormatDescriptor->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_HWACCEL)))
 	{
-		avcodec_flush_buffers(videoCodecContext);
+		qWarning("Cannot crop %s frames", av_get_pix_fmt_name(videoCodecContext->pix_fmt));
+		return false;
+	}
+
+	// the crop is given in full resolution pixels
+	int requestedCropX = settings->video.cropX >> lowresShift;
+	int requestedCropY = settings->video.cropY >> lowresShift;
+	int requestedCropWidth = settings->video.cropWidth >> lowresShift;
+	int requestedCropHeight = settings->video.cropHeight >> lowresShift;
+
+	if (requestedCropX < 0 || requestedCropY < 0 || requestedCropWidth <= 0 || requestedCropHeight <= 0 || requestedCropX + requestedCropWidth > videoCodecContext->width || requestedCropY + requestedCropHeight > videoCodecContext->height)
+	{
+		qWarning("Crop %dx%d at %d,%d does not fit in the %dx%d frame", settings->video.cropWidth, settings->video.cropHeight, settings->video.cropX, settings->video.cropY, videoCodecContext->width << lowresShift, videoCodecContext->height << lowresShift);
+		return false;
+	}
+
+	// the crop has to start and end on whole chroma samples
+	int alignmentX = 1 << pixelFormatDescriptor->log2_chroma_w;
+	int alignmentY = 1 << pixelFormatDescriptor->log2_chroma_h;
+
+	cropX = requestedCropX & ~(alignmentX - 1);
+	cropY = requestedCropY & ~(alignmentY - 1);
+	sourceWidth = std::max(alignmentX, requestedCropWidth & ~(alignmentX - 1));
+	sourceHeight = std::max(alignmentY, requestedCropHeight & ~(alignmentY - 1));
+
+	av_image_fill_max_pixsteps(cropPixelSteps, nullptr, pixelFormatDescriptor);
+	cropChromaShiftX = pixelFormatDescriptor->log2_chroma_w;
+	cropChromaShiftY = pixelFormatDescriptor->log2_chroma_h;
+
+	qDebug("Cropping video to %dx%d at %d,%d", sourceWidth, sourceHeight, cropX, cropY);
+
+	return true;
+}
+
+// Points the planes of the decoded frame at the top left corner of the crop.
+void VideoDecoder::getCroppedPicture(AVPicture& picture) const
+{
+	for (int i = 0; i < AV_NUM_DATA_POINTERS; ++i)
+	{
+		picture.data[i] = frame->data[i];
+		picture.linesize[i] = frame->linesize[i];
 
+		if (frame->data[i] == nullptr || i >= 4 || (cropX == 0 && cropY == 0))
+			continue;
+
+		// the chroma planes are subsampled, the luma and alpha planes are not
+		bool isChromaPlane = (i == 1 || i == 2);
+		int x = isChromaPlane ? (cropX >> cropChromaShiftX) : cropX;
+		int y = isChromaPlane ? (cropY >> cropChromaShiftY) : cropY;
+
+		picture.data[i] += (ptrdiff_t)y * frame->linesize[i] + (ptrdiff_t)x * cropPixelSteps[i];
+	}
+}
+
+void VideoDecoder::updateOutputFrameSize()
+{
+	int width = 0;
+	int height = 0;
+
+	statusMutex.lock();
+	width = targetFrameWidth;
+	height = targetFrameHeight;
+	statusMutex.unlock();
+
+	if (width == outputFrameWidth && height == outputFrameHeight)
+		return;
+
+	bool canCopyFrame = (framePixelFormat == videoCodecContext->pix_fmt && width == sourceWidth && height == sourceHeight);
+
+	if (!canCopyFrame && !frameConverter.initialize(sourceWidth, sourceHeight, videoCodecContext->pix_fmt, width, height, framePixelFormat, conversionThreadCount))
+	{
+		qWarning("Could not initialize frame converter for %dx%d", width, height);
+
+		// stay with the previous size
+		if (!useFrameCopy)
+			frameConverter.initialize(sourceWidth, sourceHeight, videoCodecContext->pix_fmt, outputFrameWidth, outputFrameHeight, framePixelFormat, conversionThreadCount);
+
+		QMutexLocker locker(&statusMutex);
+		targetFrameWidth = outputFrameWidth;
+		targetFrameHeight = outputFrameHeight;
+
+		return;
+	}
+
+	useFrameCopy = canCopyFrame;
+	outputFrameWidth = width;
+	outputFrameHeight = height;
+
+	if (isYuvOutput)
+	{
+		const AVPixFmtDescriptor* pixelFormatDescriptor = av_pix_fmt_desc_get(framePixelFormat);
+		outputChromaFrameWidth = -((-outputFrameWidth) >> pixelFormatDescriptor->log2_chroma_w);
+		outputChromaFrameHeight = -((-outputFrameHeight) >> pixelFormatDescriptor->log2_chroma_h);
+	}
+
+	qDebug("Decoding video frames at %dx%d", outputFrameWidth, outputFrameHeight);
+}
+
+bool VideoDecoder::buildKeyframeIndex()
+{
+	keyframeTimestamps.clear();
+
+	for (VideoInput* videoInput : videoInputs)
+	{
+		if (!videoInput->buildKeyframeIndex(keyframeTimestamps))
+			return false;
+	}
+
+	std::sort(keyframeTimestamps.begin(), keyframeTimestamps.end());
+	keyframeTimestamps.erase(std::unique(keyframeTimestamps.begin(), keyframeTimestamps.end()), keyframeTimestamps.end());
+
+	qDebug("Keyframe index has %d entries", (int)keyframeTimestamps.size());
+
+	return true;
+}
+
+bool VideoDecoder::decodeNextPicture()
+{
+	while (true)
+	{
 		int gotPicture = 0;
 
-		while (!gotPicture)
+		if (!isDraining)
 		{
-			int readResult;
-
-			if ((readResult = av_read_frame(formatContext, &packet)) >= 0)
+			if (!videoDemuxerThread->readPacket(packet))
 			{
-				if (packet.stream_index == videoStreamIndex)
-					avcodec_decode_video2(videoCodecContext, frame, &gotPicture, &packet);
-
-				av_free_packet(&packet);
+				// the decoder may still hold delayed frames (e.g. with frame threading)
+				isDraining = true;
+				continue;
 			}
+
+			// frames that will not be shown and that no other frame depends on do not need to be decoded at all
+			if ((isDecimating || isSeeking) && packet.pts != AV_NOPTS_VALUE && packet.pts < nextOutputTimestamp - halfFrameInterval)
+				videoCodecContext->skip_frame = AVDISCARD_NONREF;
 			else
+				videoCodecContext->skip_frame = AVDISCARD_DEFAULT;
+
+			int decodedBytes = avcodec_decode_video2(videoCodecContext, frame, &gotPicture, &packet);
+			av_free_packet(&packet);
+
+			if (decodedBytes < 0)
 			{
-				if (readResult != AVERROR_EOF)
-					qWarning("Could not read a frame: %d", readResult);
+				qWarning("Could not decode video frame");
+				return false;
+			}
+		}
+		else
+		{
+			AVPacket flushPacket;
+			av_init_packet(&flushPacket);
+			flushPacket.data = nullptr;
+			flushPacket.size = 0;
 
+			if (avcodec_decode_video2(videoCodecContext, frame, &gotPicture, &flushPacket) < 0 || !gotPicture)
+			{
 				isFinished = true;
-				return;
+				return false;
 			}
 		}
+
+		if (gotPicture)
+			return true;
 	}
-	else
-		qWarning("Could not seek video");
+}
+
+void VideoDecoder::seekToTimestamp(int64_t targetTimestamp)
+{
+	if (endTimestamp != AV_NOPTS_VALUE)
+		targetTimestamp = std::min(targetTimestamp, endTimestamp);
+
+	targetTimestamp = std::max(startTimestamp, targetTimestamp);
+
+	isFinished = false;
+	nextOutputTimestamp = (double)targetTimestamp;
+	resetMotion();
+	motionVectorEstimator.reset();
+
+	// the frames before the target can be skipped like the dropped frames when decimating
+	isSeeking = true;
+	hasPendingFrame = decodeToTimestamp(targetTimestamp);
+	isSeeking = false;
+
+	if (hasPendingFrame)
+	{
+		previousFrameTimestamp = frame->best_effort_timestamp;
+		currentTimeInSeconds = getTimeFromTimestamp(previousFrameTimestamp);
+	}
+}
+
+bool VideoDecoder::decodeToTimestamp(int64_t targetTimestamp)
+{
+	if (seekToAnyFrame)
+	{
+		// fast, but the frames will be corrupted until the next keyframe
+		if (!videoDemuxerThread->seek(targetTimestamp, AVSEEK_FLAG_ANY | AVSEEK_FLAG_BACKWARD))
+		{
+			qWarning("Could not seek video");
+			return false;
+		}
+
+		avcodec_flush_buffers(videoCodecContext);
+		isDraining = false;
+
+		return decodeNextPicture();
+	}
+
+	// land on the frame nearest to the target
+	int64_t firstValidTimestamp = targetTimestamp - halfFrameInterval;
+
+	auto keyframe = std::upper_bound(keyframeTimestamps.begin(), keyframeTimestamps.end(), targetTimestamp);
+
+	if (keyframe != keyframeTimestamps.begin())
+		--keyframe;
+
+	while (true)
+	{
+		int64_t keyframeTimestamp = (keyframe != keyframeTimestamps.end()) ? *keyframe : targetTimestamp;
+
+		if (!videoDemuxerThread->seek(keyframeTimestamp, AVSEEK_FLAG_BACKWARD))
+		{
+			qWarning("Could not seek video");
+			return false;
+		}
+
+		avcodec_flush_buffers(videoCodecContext);
+		isDraining = false;
+
+		if (isSeekCancelled.load() != 0 || !decodeNextPicture())
+			return false;
+
+		// with frame reordering the keyframe can be presented after the target, so start from an earlier one
+		if (frame->best_effort_timestamp > firstValidTimestamp && keyframe != keyframeTimestamps.begin() && keyframe != keyframeTimestamps.end())
+		{
+			--keyframe;
+			continue;
+		}
+
+		break;
+	}
+
+	// decode forward to the target frame
+	while (frame->best_effort_timestamp < firstValidTimestamp)
+	{
+		if (isSeekCancelled.load() != 0 || !decodeNextPicture())
+			return false;
+	}
+
+	return true;
+}
+
+void VideoDecoder::resetMotion()
+{
+	isMotionValid = true;
+	motionX = 0.0;
+	motionY = 0.0;
+	motionAngle = 0.0;
+}
+
+double VideoDecoder::getTimeFromTimestamp(int64_t timestamp) const
+{
+	return (double)(timestamp - startTimestamp) * videoStream->time_base.num / videoStream->time_base.den;
+}
+
+int64_t VideoDecoder::getTimestampFromTime(double seconds) const
+{
+	return startTimestamp + (int64_t)(seconds * videoStream->time_base.den / videoStream->time_base.num + 0.5);
 }
 
 bool VideoDecoder::getIsFinished()
@@ -366,11 +916,28 @@ double VideoDecoder::getCurrentTime()
 
 double VideoDecoder::getLastDecodeTime()
 {
-	QMutexLocker locker(&decoderMutex);
+	QMutexLocker locker(&statusMutex);
 
 	return lastDecodeTime;
 }
 
+double VideoDecoder::getReadThroughput()
+{
+	int64_t bytesRead = 0;
+	double readTime = 0.0;
+
+	for (VideoInput* videoInput : videoInputs)
+	{
+		bytesRead += videoInput->getBytesRead();
+		readTime += videoInput->getReadTime();
+	}
+
+	if (readTime <= 0.0)
+		return 0.0;
+
+	return (bytesRead / (1024.0 * 1024.0)) / readTime;
+}
+
 int VideoDecoder::getFrameWidth() const
 {
 	return frameWidth;
@@ -381,6 +948,57 @@ int VideoDecoder::getFrameHeight() const
 	return frameHeight;
 }
 
+int VideoDecoder::getGrayscaleFrameWidth() const
+{
+	return grayscaleFrameWidth;
+}
+
+int VideoDecoder::getGrayscaleFrameHeight() const
+{
+	return grayscaleFrameHeight;
+}
+
+size_t VideoDecoder::getFrameDataLength() const
+{
+	if (!isInitialized)
+		return 0;
+
+	return (size_t)avpicture_get_size(framePixelFormat, frameWidth, frameHeight);
+}
+
+size_t VideoDecoder::getGrayscaleFrameDataLength() const
+{
+	if (!isInitialized)
+		return 0;
+
+	return (size_t)avpicture_get_size(PIX_FMT_GRAY8, grayscaleFrameWidth, grayscaleFrameHeight);
+}
+
+bool VideoDecoder::getIsYuvOutput() const
+{
+	return isYuvOutput;
+}
+
+bool VideoDecoder::getIsBt709() const
+{
+	return isBt709;
+}
+
+bool VideoDecoder::getIsFullRange() const
+{
+	return isFullRange;
+}
+
+int VideoDecoder::getChromaFrameWidth() const
+{
+	return chromaFrameWidth;
+}
+
+int VideoDecoder::getChromaFrameHeight() const
+{
+	return chromaFrameHeight;
+}
+
 int VideoDecoder::getTotalFrameCount() const
 {
 	return totalFrameCount;
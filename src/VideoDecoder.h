@@ -3,38 +3,63 @@
 
 #pragma once
 
+#include <vector>
+
 #include <QMutex>
+#include <QAtomicInt>
 #include <QElapsedTimer>
 
 extern "C"
 {
 #include "libavformat/avformat.h"
 #include "libavutil/avutil.h"
-#include "libswscale/swscale.h"
 }
 
+#include "FrameConverter.h"
+#include "BoxDownscaler.h"
+#include "MotionVectorEstimator.h"
+
 namespace OrientView
 {
 	class Settings;
+	class VideoDemuxerThread;
+	class VideoInput;
 	struct FrameData;
 
+	enum VideoDecoderThreadType { Automatic, FrameThreading, SliceThreading };
+	enum VideoDecoderProfile { FullQuality, FastAnalysis };
+
 	// Encapsulate the FFmpeg library for reading and decoding video files.
 	class VideoDecoder
 	{
 
 	public:
 
-		bool initialize(Settings* settings);
+		bool initialize(Settings* settings, VideoDecoderProfile profile);
 		~VideoDecoder();
 
 		bool getNextFrame(FrameData* frameData, FrameData* frameDataGrayscale);
 		void seekRelative(double seconds);
+		void seekAbsolute(double seconds);
+		double getKeyframeTime(double seconds);
+		void setTargetFrameSize(int width, int height);
+		void setSeekCancelled(bool value);
 
 		bool getIsFinished();
 		double getCurrentTime();
 		double getLastDecodeTime();
+		double getReadThroughput();
 		int getFrameWidth() const;
 		int getFrameHeight() const;
+		int getGrayscaleFrameWidth() const;
+		int getGrayscaleFrameHeight() const;
+		size_t getFrameDataLength() const;
+		size_t getGrayscaleFrameDataLength() const;
+		bool getIsYuvOutput() const;
+		bool getIsBt709() const;
+		bool getIsFullRange() const;
+		int getChromaFrameWidth() const;
+		int getChromaFrameHeight() const;
 		int getTotalFrameCount() const;
 		int getFrameRateNum() const;
 		int getFrameRateDen() const;
@@ -42,22 +67,69 @@ namespace OrientView
 
 	private:
 
+		bool initializeCrop(Settings* settings);
+		void getCroppedPicture(AVPicture& picture) const;
+		void updateOutputFrameSize();
+		bool buildKeyframeIndex();
+		bool decodeNextPicture();
+		void seekToTimestamp(int64_t targetTimestamp);
+		bool decodeToTimestamp(int64_t targetTimestamp);
+		void resetMotion();
+		double getTimeFromTimestamp(int64_t timestamp) const;
+		int64_t getTimestampFromTime(double seconds) const;
+
 		QMutex decoderMutex;
+		QMutex statusMutex; // the render threads read the status while a seek is holding the decoder mutex
+		QAtomicInt isSeekCancelled;
 
-		AVFormatContext* formatContext = nullptr;
+		std::vector<VideoInput*> videoInputs;
+		VideoDemuxerThread* videoDemuxerThread = nullptr;
 		AVCodecContext* videoCodecContext = nullptr;
 		AVStream* videoStream = nullptr;
 		AVFrame* frame = nullptr;
 		AVPacket packet;
 		int videoStreamIndex = 0;
 
-		SwsContext* swsContext = nullptr;
-		SwsContext* swsContextGrayscale = nullptr;
+		FrameConverter frameConverter;
+		FrameConverter frameConverterGrayscale;
+		BoxDownscaler boxDownscaler;
 		AVPicture* convertedPicture = nullptr;
 		AVPicture* convertedPictureGrayscale = nullptr;
 
+		MotionVectorEstimator motionVectorEstimator;
+		bool exportMotionVectors = false;
+		bool isMotionValid = true; // every frame since the previous output frame had motion vectors
+		double motionX = 0.0; // since the previous output frame
+		double motionY = 0.0;
+		double motionAngle = 0.0;
+
+		AVPixelFormat framePixelFormat = PIX_FMT_RGBA;
+		bool useFrameCopy = false;
+		bool useLumaDownscale = false;
+		bool isYuvOutput = false;
+		bool isBt709 = false;
+		bool isFullRange = false;
+
+		int lowresShift = 0; // the decoded frames are this many halvings smaller than the video
+		int sourceWidth = 0; // size of the cropped region of the decoded frames
+		int sourceHeight = 0;
+		int cropX = 0;
+		int cropY = 0;
+		int cropPixelSteps[4] = { 0 };
+		int cropChromaShiftX = 0;
+		int cropChromaShiftY = 0;
+
 		int frameWidth = 0;
 		int frameHeight = 0;
+		int chromaFrameWidth = 0;
+		int chromaFrameHeight = 0;
+		int outputFrameWidth = 0; // can be smaller than the frame width when the video is shown smaller
+		int outputFrameHeight = 0;
+		int outputChromaFrameWidth = 0;
+		int outputChromaFrameHeight = 0;
+		int targetFrameWidth = 0; // guarded by the status mutex
+		int targetFrameHeight = 0; // guarded by the status mutex
+		int conversionThreadCount = 0;
 		int grayscaleFrameWidth = 0;
 		int grayscaleFrameHeight = 0;
 
@@ -71,12 +143,23 @@ namespace OrientView
 		int64_t frameRateDen = 0; // no unit
 		int64_t frameDuration = 0.0; // microseconds
 		int64_t previousFrameTimestamp = 0; // video stream time base units
+		int64_t startTimestamp = 0; // video stream time base units
+		int64_t endTimestamp = AV_NOPTS_VALUE; // video stream time base units
+		int64_t halfFrameInterval = 0; // video stream time base units
+		double outputFrameInterval = 0.0; // video stream time base units
+		double nextOutputTimestamp = 0.0; // video stream time base units
+
+		std::vector<int64_t> keyframeTimestamps; // sorted, video stream time base units
 
 		double currentTimeInSeconds = 0.0;
 
 		bool isInitialized = false;
 		bool isFinished = false;
+		bool isDraining = false;
+		bool hasPendingFrame = false;
 		bool seekToAnyFrame = false;
+		bool isDecimating = false;
+		bool isSeeking = false;
 
 		QElapsedTimer decodeTimer;
 		double lastDecodeTime = 0.0;
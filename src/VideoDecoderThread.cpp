@@ -1,68 +1,349 @@
 // Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
 // License: GPLv3, see the LICENSE file.
 
+#include <algorithm>
+
 #include "VideoDecoderThread.h"
 #include "VideoDecoder.h"
+#include "Settings.h"
 
 using namespace OrientView;
 
-void VideoDecoderThread::initialize(VideoDecoder* videoDecoder)
+// The frame cache size is in megabytes, zero leaves the stepping backwards without a cache (e.g. when exporting).
+// The held frames are the ones the consumer keeps for a while before releasing them.
+bool VideoDecoderThread::initialize(VideoDecoder* videoDecoder, Settings* settings, int frameCacheSize, int heldFrameCount)
 {
 	this->videoDecoder = videoDecoder;
 
-	frameReadSemaphore = new QSemaphore();
-	frameAvailableSemaphore = new QSemaphore();
-	decodedFrameData = FrameData();
-	decodedFrameDataGrayscale = FrameData();
-}
+	int frameQueueSize = std::max(1, settings->video.frameQueueSize);
 
-VideoDecoderThread::~VideoDecoderThread()
-{
-	if (frameAvailableSemaphore != nullptr)
+	size_t frameCacheByteCount = (size_t)std::max(0, frameCacheSize) * 1024 * 1024;
+	size_t cachedFrameDataLength = videoDecoder->getFrameDataLength() + videoDecoder->getGrayscaleFrameDataLength();
+	int frameCacheCount = (cachedFrameDataLength > 0) ? (int)(frameCacheByteCount / cachedFrameDataLength) : 0;
+
+	frameCache.initialize(frameCacheCount);
+	qDebug("Frame cache can hold %d frames", frameCacheCount);
+
+	// the producer and the consumer both need one extra frame in addition to the queued, the cached and the held ones
+	int frameCount = frameQueueSize + frameCacheCount + std::max(0, heldFrameCount) + 2;
+
+	if (!framePool.initialize(frameCount, videoDecoder->getFrameDataLength()))
 	{
-		delete frameAvailableSemaphore;
-		frameAvailableSemaphore = nullptr;
+		qWarning("Could not initialize frame pool");
+		return false;
 	}
 
-	if (frameReadSemaphore != nullptr)
+	if (!framePoolGrayscale.initialize(frameCount, videoDecoder->getGrayscaleFrameDataLength()))
 	{
-		delete frameReadSemaphore;
-		frameReadSemaphore = nullptr;
+		qWarning("Could not initialize grayscale frame pool");
+		return false;
 	}
+
+	frameQueue.initialize(frameQueueSize);
+
+	return true;
 }
 
 void VideoDecoderThread::run()
 {
-	frameReadSemaphore->release(1);
-
 	while (!isInterruptionRequested())
 	{
-		while (!frameReadSemaphore->tryAcquire(1, 100) && !isInterruptionRequested()) {}
+		processSeekRequest();
+
+		DecodedFrame decodedFrame;
+		bool withGrayscale = (isGrayscaleRequested.load() != 0);
+
+		if (!framePool.tryAcquireFrame(decodedFrame.frameData, 100))
+			continue;
+
+		if (withGrayscale)
+			while (!framePoolGrayscale.tryAcquireFrame(decodedFrame.frameDataGrayscale, 100) && !isInterruptionRequested()) {}
 
 		if (isInterruptionRequested())
+		{
+			releaseFrame(decodedFrame.frameData, decodedFrame.frameDataGrayscale);
 			break;
+		}
+
+		bool gotFrame = false;
 
-		if (videoDecoder->getNextFrame(&decodedFrameData, &decodedFrameDataGrayscale))
-			frameAvailableSemaphore->release(1);
-		else
-			QThread::msleep(100);
+		{
+			QMutexLocker locker(&decoderMutex);
+
+			decodedFrame.seekCount = decoderSeekCount;
+			gotFrame = decodeNextFrame(decodedFrame, withGrayscale);
+
+			// the frames up to the one stepped back from fill the cache, the ones after it continue the playback
+			if (gotFrame && isCaching)
+			{
+				decodedFrame.isForCache = true;
+
+				if (decodedFrame.frameData.timeStamp >= cacheEndTimeStamp)
+					isCaching = false;
+			}
+
+			// the end of the stream before a newer seek does not count
+			if (!gotFrame && videoDecoder->getIsFinished() && decoderSeekCount == seekCount.load())
+				isFinished.store(1);
+		}
+
+		if (!gotFrame)
+		{
+			releaseFrame(decodedFrame.frameData, decodedFrame.frameDataGrayscale);
+
+			QMutexLocker locker(&seekMutex);
+
+			if (!hasSeekRequest)
+				seekRequested.wait(&seekMutex, 100);
+
+			continue;
+		}
+
+		bool wasPushed = false;
+
+		// a stale frame is not worth waiting for room in the queue
+		while (!(wasPushed = frameQueue.tryPush(decodedFrame, 100)) && !isInterruptionRequested() && decodedFrame.seekCount == seekCount.load()) {}
+
+		if (!wasPushed)
+			releaseFrame(decodedFrame.frameData, decodedFrame.frameDataGrayscale);
 	}
+
+	clearFrameQueue();
 }
 
 bool VideoDecoderThread::tryGetNextFrame(FrameData& frameData, FrameData& frameDataGrayscale, int timeout)
 {
-	if (frameAvailableSemaphore->tryAcquire(1, timeout))
+	if (isBrowsingCache)
 	{
-		frameData = decodedFrameData;
-		frameDataGrayscale = decodedFrameDataGrayscale;
+		int64_t nextTimeStamp = 0;
+
+		if (frameCache.tryGetNextTimeStamp(currentTimeStamp, nextTimeStamp) && frameCache.tryGetFrame(nextTimeStamp, frameData, frameDataGrayscale))
+		{
+			setCurrentFrame(frameData);
+			return true;
+		}
+
+		isBrowsingCache = false;
 
-		return true;
+		// the queue continues right after the last frame taken from it, otherwise move the decoder to the next frame
+		if (!hasLastQueueTimeStamp || lastQueueTimeStamp != currentTimeStamp)
+			seekAbsolute(currentFrameTime + currentFrameDuration / 1000000.0);
 	}
+
+	DecodedFrame decodedFrame;
+
+	while (frameQueue.tryPop(decodedFrame, timeout))
+	{
+		// the frames of a step backwards go to the cache, the previous frame is shown when they are all there
+		if (decodedFrame.seekCount == seekCount.load() && decodedFrame.isForCache)
+		{
+			int64_t timeStamp = decodedFrame.frameData.timeStamp;
+
+			frameCache.insert(decodedFrame.frameData, decodedFrame.frameDataGrayscale, hasLastQueueTimeStamp, lastQueueTimeStamp);
+			releaseFrame(decodedFrame.frameData, decodedFrame.frameDataGrayscale);
+
+			// the queue continues from the frame after this one
+			hasLastQueueTimeStamp = true;
+			lastQueueTimeStamp = timeStamp;
+
+			if (isWaitingForCache && timeStamp >= cacheTargetTimeStamp)
+			{
+				isWaitingForCache = false;
+				isWaitingForSeek = false;
+
+				return tryGetCachedPreviousFrame(frameData, frameDataGrayscale);
+			}
+
+			continue;
+		}
+
+		// frames decoded before the latest seek are stale
+		if (decodedFrame.seekCount == seekCount.load())
+		{
+			frameData = decodedFrame.frameData;
+			frameDataGrayscale = decodedFrame.frameDataGrayscale;
+			isWaitingForSeek = false;
+
+			frameCache.insert(frameData, frameDataGrayscale, hasLastQueueTimeStamp, lastQueueTimeStamp);
+			hasLastQueueTimeStamp = true;
+			lastQueueTimeStamp = frameData.timeStamp;
+			setCurrentFrame(frameData);
+
+			return true;
+		}
+
+		releaseFrame(decodedFrame.frameData, decodedFrame.frameDataGrayscale);
+	}
+
+	return false;
+}
+
+// If the previous frame is not cached, the decoder thread is asked to cache the group of pictures around it and the frame comes out of tryGetNextFrame when it is there.
+bool VideoDecoderThread::tryGetPreviousFrame(FrameData& frameData, FrameData& frameDataGrayscale)
+{
+	if (!hasCurrentFrame || isWaitingForCache)
+		return false;
+
+	int64_t previousTimeStamp = 0;
+
+	if (frameCache.tryGetPreviousTimeStamp(currentTimeStamp, previousTimeStamp))
+		return tryGetCachedPreviousFrame(frameData, frameDataGrayscale);
+
+	if (frameCache.getMaxFrameCount() < 2)
+		seekAbsolute(currentFrameTime - currentFrameDuration / 1000000.0);
 	else
+		requestGroupOfPictures();
+
+	return false;
+}
+
+bool VideoDecoderThread::tryGetCachedPreviousFrame(FrameData& frameData, FrameData& frameDataGrayscale)
+{
+	int64_t previousTimeStamp = 0;
+
+	// without room in the cache the previous frame comes through the queue after an exact seek
+	if (!frameCache.tryGetPreviousTimeStamp(currentTimeStamp, previousTimeStamp) || !frameCache.tryGetFrame(previousTimeStamp, frameData, frameDataGrayscale))
+	{
+		seekAbsolute(currentFrameTime - currentFrameDuration / 1000000.0);
 		return false;
+	}
+
+	isBrowsingCache = true;
+	setCurrentFrame(frameData);
+
+	return true;
+}
+
+void VideoDecoderThread::releaseFrame(FrameData& frameData, FrameData& frameDataGrayscale)
+{
+	framePool.releaseFrame(frameData);
+	framePoolGrayscale.releaseFrame(frameDataGrayscale);
+}
+
+// Seeks are relative to the frame on screen, or to the target of a seek that has not shown up yet.
+void VideoDecoderThread::seekRelative(double seconds)
+{
+	double baseTime = isWaitingForSeek ? lastSeekTime : (hasCurrentFrame ? currentFrameTime : 0.0);
+
+	seekAbsolute(std::max(0.0, baseTime + seconds));
+}
+
+// Post the seek to the decoder thread, the frames decoded before it are dropped when they come out of the queue.
+void VideoDecoderThread::seekAbsolute(double seconds)
+{
+	postSeekRequest(seconds, false, 0);
+}
+
+void VideoDecoderThread::postSeekRequest(double seconds, bool isCaching, int64_t cacheEndTimeStamp)
+{
+	isBrowsingCache = false;
+	hasLastQueueTimeStamp = false;
+	isWaitingForSeek = true;
+	isWaitingForCache = false;
+	lastSeekTime = seconds;
+
+	{
+		QMutexLocker locker(&seekMutex);
+
+		hasSeekRequest = true;
+		seekRequestTime = seconds;
+		seekRequestIsCaching = isCaching;
+		seekRequestCacheEndTimeStamp = cacheEndTimeStamp;
+		seekRequestCount = seekCount.fetchAndAddOrdered(1) + 1;
+		isFinished.store(0);
+
+		// abandon the seek the decoder thread may still be working on
+		videoDecoder->setSeekCancelled(true);
+		seekRequested.wakeAll();
+	}
+
+	clearFrameQueue();
+}
+
+void VideoDecoderThread::setIsGrayscaleRequested(bool value)
+{
+	isGrayscaleRequested.store(value ? 1 : 0);
+}
+
+bool VideoDecoderThread::getIsFinished() const
+{
+	return (isFinished.load() != 0 && frameQueue.getCount() == 0);
+}
+
+void VideoDecoderThread::processSeekRequest()
+{
+	double seekTime = 0.0;
+	int requestSeekCount = 0;
+	bool isCachingRequest = false;
+	int64_t cachingEndTimeStamp = 0;
+
+	{
+		QMutexLocker locker(&seekMutex);
+
+		if (!hasSeekRequest)
+			return;
+
+		seekTime = seekRequestTime;
+		requestSeekCount = seekRequestCount;
+		isCachingRequest = seekRequestIsCaching;
+		cachingEndTimeStamp = seekRequestCacheEndTimeStamp;
+		hasSeekRequest = false;
+
+		videoDecoder->setSeekCancelled(false);
+	}
+
+	// caching starts from the keyframe, looking it up can wait for the decoder so it is done here
+	if (isCachingRequest)
+		seekTime = videoDecoder->getKeyframeTime(seekTime);
+
+	QMutexLocker locker(&decoderMutex);
+
+	videoDecoder->seekAbsolute(seekTime);
+	decoderSeekCount = requestSeekCount;
+	isCaching = isCachingRequest;
+	cacheEndTimeStamp = cachingEndTimeStamp;
+}
+
+void VideoDecoderThread::clearFrameQueue()
+{
+	DecodedFrame decodedFrame;
+
+	while (frameQueue.tryPop(decodedFrame, 0))
+		releaseFrame(decodedFrame.frameData, decodedFrame.frameDataGrayscale);
+}
+
+// The decoder thread decodes the frames from the keyframe before the previous frame up to the current frame, and they are put to the cache as they come out of the queue.
+void VideoDecoderThread::requestGroupOfPictures()
+{
+	int64_t targetTimeStamp = currentTimeStamp;
+
+	postSeekRequest(currentFrameTime - currentFrameDuration / 1000000.0, true, targetTimeStamp);
+
+	isWaitingForCache = true;
+	cacheTargetTimeStamp = targetTimeStamp;
+}
+
+void VideoDecoderThread::setCurrentFrame(const FrameData& frameData)
+{
+	hasCurrentFrame = true;
+	currentTimeStamp = frameData.timeStamp;
+	currentFrameDuration = frameData.duration;
+	currentFrameTime = frameData.time;
 }
 
-void VideoDecoderThread::signalFrameRead()
+// Without a request the grayscale frame has no image, only the timing of the frame.
+bool VideoDecoderThread::decodeNextFrame(DecodedFrame& decodedFrame, bool withGrayscale)
 {
-	frameReadSemaphore->release(1);
+	if (!videoDecoder->getNextFrame(&decodedFrame.frameData, withGrayscale ? &decodedFrame.frameDataGrayscale : nullptr))
+		return false;
+
+	if (!withGrayscale)
+	{
+		decodedFrame.frameDataGrayscale.duration = decodedFrame.frameData.duration;
+		decodedFrame.frameDataGrayscale.timeStamp = decodedFrame.frameData.timeStamp;
+		decodedFrame.frameDataGrayscale.cumulativeNumber = decodedFrame.frameData.cumulativeNumber;
+		decodedFrame.frameDataGrayscale.time = decodedFrame.frameData.time;
+	}
+
+	return true;
 }
@@ -4,13 +4,19 @@
 #pragma once
 
 #include <QThread>
-#include <QSemaphore>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QAtomicInt>
 
 #include "FrameData.h"
+#include "FramePool.h"
+#include "BoundedQueue.h"
+#include "FrameCache.h"
 
 namespace OrientView
 {
 	class VideoDecoder;
+	class Settings;
 
 	// Run video decoder on a thread.
 	class VideoDecoderThread : public QThread
@@ -19,11 +25,16 @@ namespace OrientView
 
 	public:
 
-		void initialize(VideoDecoder* videoDecoder);
-		~VideoDecoderThread();
+		bool initialize(VideoDecoder* videoDecoder, Settings* settings, int frameCacheSize, int heldFrameCount);
 
 		bool tryGetNextFrame(FrameData& frameData, FrameData& frameDataGrayscale, int timeout);
-		void signalFrameRead();
+		bool tryGetPreviousFrame(FrameData& frameData, FrameData& frameDataGrayscale);
+		void releaseFrame(FrameData& frameData, FrameData& frameDataGrayscale);
+		void seekRelative(double seconds);
+		void seekAbsolute(double seconds);
+		void setIsGrayscaleRequested(bool value);
+
+		bool getIsFinished() const;
 
 	protected:
 
@@ -31,12 +42,60 @@ namespace OrientView
 
 	private:
 
+		struct DecodedFrame
+		{
+			FrameData frameData;
+			FrameData frameDataGrayscale;
+			int seekCount = 0;
+			bool isForCache = false; // decoded for stepping backwards, goes to the frame cache instead of the screen
+		};
+
+		void clearFrameQueue();
+		void postSeekRequest(double seconds, bool isCaching, int64_t cacheEndTimeStamp);
+		void processSeekRequest();
+		void requestGroupOfPictures();
+		bool tryGetCachedPreviousFrame(FrameData& frameData, FrameData& frameDataGrayscale);
+		void setCurrentFrame(const FrameData& frameData);
+		bool decodeNextFrame(DecodedFrame& decodedFrame, bool withGrayscale);
+
 		VideoDecoder* videoDecoder = nullptr;
 
-		QSemaphore* frameReadSemaphore = nullptr;
-		QSemaphore* frameAvailableSemaphore = nullptr;
+		QMutex decoderMutex;
+		int decoderSeekCount = 0; // seek the decoder position belongs to, guarded by the decoder mutex
+
+		// the latest seek request, older ones are overwritten before the decoder thread gets to them
+		QMutex seekMutex;
+		QWaitCondition seekRequested;
+		bool hasSeekRequest = false;
+		double seekRequestTime = 0.0;
+		int seekRequestCount = 0;
+		bool seekRequestIsCaching = false; // decode from the keyframe before the time up to the end time stamp into the cache
+		int64_t seekRequestCacheEndTimeStamp = 0;
+
+		// decoder thread state of the current caching request
+		bool isCaching = false;
+		int64_t cacheEndTimeStamp = 0;
+
+		FramePool framePool;
+		FramePool framePoolGrayscale;
+		BoundedQueue<DecodedFrame> frameQueue;
+		FrameCache frameCache;
+
+		QAtomicInt seekCount;
+		QAtomicInt isFinished;
+		QAtomicInt isGrayscaleRequested;
 
-		FrameData decodedFrameData;
-		FrameData decodedFrameDataGrayscale;
+		// consumer side state, only touched from the thread that takes the frames
+		bool hasCurrentFrame = false;
+		bool isBrowsingCache = false;
+		bool hasLastQueueTimeStamp = false;
+		bool isWaitingForSeek = false;
+		bool isWaitingForCache = false;
+		int64_t cacheTargetTimeStamp = 0; // the frame stepped back from
+		int64_t currentTimeStamp = 0;
+		int64_t currentFrameDuration = 0;
+		int64_t lastQueueTimeStamp = 0;
+		double currentFrameTime = 0.0;
+		double lastSeekTime = 0.0;
 	};
 }
@@ -0,0 +1,135 @@
+// Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: GPLv3, see the LICENSE file.
+
+#include <algorithm>
+
+#include "VideoDemuxerThread.h"
+#include "VideoInput.h"
+#include "Settings.h"
+
+using namespace OrientView;
+
+bool VideoDemuxerThread::initialize(const std::vector<VideoInput*>& videoInputs, Settings* settings)
+{
+	if (videoInputs.empty())
+		return false;
+
+	this->videoInputs = videoInputs;
+
+	packetQueue.initialize((size_t)std::max(1, settings->video.packetQueueSize) * 1024 * 1024);
+	selectInput(0);
+
+	return true;
+}
+
+void VideoDemuxerThread::stop()
+{
+	requestInterruption();
+	packetQueue.abort();
+
+	formatMutex.lock();
+	seekRequested.wakeAll();
+	formatMutex.unlock();
+
+	wait();
+}
+
+void VideoDemuxerThread::run()
+{
+	while (!isInterruptionRequested())
+	{
+		AVPacket packet;
+		av_init_packet(&packet);
+		packet.data = nullptr;
+		packet.size = 0;
+
+		int serial = 0;
+
+		{
+			QMutexLocker locker(&formatMutex);
+
+			// nothing to do at the end of the file until the next seek
+			if (isAtEnd)
+			{
+				seekRequested.wait(&formatMutex, 100);
+				continue;
+			}
+
+			// get the next file ready while this one is being read
+			if (!isNextInputPrefetched)
+			{
+				if (currentInputIndex + 1 < videoInputs.size() && !videoInputs[currentInputIndex + 1]->prefetch())
+					qWarning("Could not prefetch %s", qPrintable(videoInputs[currentInputIndex + 1]->getFileName()));
+
+				isNextInputPrefetched = true;
+			}
+
+			serial = packetQueue.getSerial();
+			int readResult = videoInputs[currentInputIndex]->readPacket(packet);
+
+			if (readResult < 0)
+			{
+				if (readResult != AVERROR_EOF)
+					qWarning("Could not read a frame: %d", readResult);
+
+				if (currentInputIndex + 1 < videoInputs.size())
+				{
+					selectInput(currentInputIndex + 1);
+
+					// the prefetch has normally already rewound it
+					if (!videoInputs[currentInputIndex]->prefetch())
+						qWarning("Could not rewind %s", qPrintable(videoInputs[currentInputIndex]->getFileName()));
+
+					continue;
+				}
+
+				isAtEnd = true;
+				packetQueue.setEndOfStream(serial);
+				continue;
+			}
+		}
+
+		// the packet data has to outlive the next read
+		if (av_dup_packet(&packet) < 0 || !packetQueue.push(packet, serial))
+			av_free_packet(&packet);
+	}
+}
+
+// Returns false at the end of the stream. The caller frees the packet.
+bool VideoDemuxerThread::readPacket(AVPacket& packet)
+{
+	return packetQueue.pop(packet);
+}
+
+// Waits for a read in progress, then drops the queued packets and the ones read before the seek. The time stamp is in the timeline time base.
+bool VideoDemuxerThread::seek(int64_t timestamp, int flags)
+{
+	QMutexLocker locker(&formatMutex);
+
+	size_t index = 0;
+
+	// the file that the time stamp falls into
+	while (index + 1 < videoInputs.size() && timestamp >= videoInputs[index + 1]->getStartTimestamp())
+		++index;
+
+	if (index != currentInputIndex)
+		selectInput(index);
+
+	bool seekResult = videoInputs[index]->seek(timestamp, flags);
+
+	packetQueue.flush();
+	isAtEnd = false;
+	seekRequested.wakeAll();
+
+	return seekResult;
+}
+
+// Must be called with the format mutex held. Only the current and the next file read ahead.
+void VideoDemuxerThread::selectInput(size_t index)
+{
+	currentInputIndex = index;
+	isNextInputPrefetched = false;
+
+	for (size_t i = 0; i < videoInputs.size(); ++i)
+		videoInputs[i]->setReadAheadEnabled(i == index || i == index + 1);
+}
@@ -0,0 +1,55 @@
+// Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: GPLv3, see the LICENSE file.
+
+#pragma once
+
+#include <vector>
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+
+extern "C"
+{
+#include "libavformat/avformat.h"
+}
+
+#include "PacketQueue.h"
+
+namespace OrientView
+{
+	class Settings;
+	class VideoInput;
+
+	// Read the video packets from the files on a thread ahead of the decoder. Continues from one file to the next without a gap.
+	class VideoDemuxerThread : public QThread
+	{
+		Q_OBJECT
+
+	public:
+
+		bool initialize(const std::vector<VideoInput*>& videoInputs, Settings* settings);
+		void stop();
+
+		bool readPacket(AVPacket& packet);
+		bool seek(int64_t timestamp, int flags);
+
+	protected:
+
+		void run();
+
+	private:
+
+		void selectInput(size_t index);
+
+		std::vector<VideoInput*> videoInputs;
+		size_t currentInputIndex = 0;
+		bool isNextInputPrefetched = false;
+
+		PacketQueue packetQueue;
+
+		QMutex formatMutex;
+		QWaitCondition seekRequested;
+		bool isAtEnd = false;
+	};
+}
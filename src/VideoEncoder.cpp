@@ -62,11 +62,9 @@ bool VideoEncoder::initialize(VideoDecoder* videoDecoder, Settings* settings)
 		return false;
 	}
 
-	swsContext = sws_getContext(settings->window.width, settings->window.height, PIX_FMT_RGBA, settings->window.width, settings->window.height, PIX_FMT_YUV420P, SWS_BILINEAR, nullptr, nullptr, nullptr);
-
-	if (!swsContext)
+	if (!frameConverter.initialize(settings->window.width, settings->window.height, PIX_FMT_RGBA, settings->window.width, settings->window.height, PIX_FMT_YUV420P, settings->encoder.conversionThreadCount))
 	{
-		qWarning("Could not get sws context");
+		qWarning("Could not initialize frame converter");
 		return false;
 	}
 
@@ -102,12 +100,6 @@ VideoEncoder::~VideoEncoder()
 		mp4File = nullptr;
 	}
 
-	if (swsContext != nullptr)
-	{
-		sws_freeContext(swsContext);
-		swsContext = nullptr;
-	}
-
 	if (convertedPicture != nullptr)
 	{
 		x264_picture_clean(convertedPicture);
@@ -126,7 +118,10 @@ void VideoEncoder::readFrameData(const FrameData& frameData)
 {
 	encodeTimer.restart();
 
-	sws_scale(swsContext, &frameData.data, (int*)(&frameData.rowLength), 0, frameData.height, convertedPicture->img.plane, convertedPicture->img.i_stride);
+	const uint8_t* sourceData[4] = { frameData.data, nullptr, nullptr, nullptr };
+	int sourceLineSize[4] = { (int)frameData.rowLength, 0, 0, 0 };
+
+	frameConverter.convert(sourceData, sourceLineSize, convertedPicture->img.plane, convertedPicture->img.i_stride);
 }
 
 int VideoEncoder::encodeFrame()
@@ -10,9 +10,10 @@ extern "C"
 {
 #include <stdint.h>
 #include "x264.h"
-#include "libswscale/swscale.h"
 }
 
+#include "FrameConverter.h"
+
 namespace OrientView
 {
 	class VideoDecoder;
@@ -41,7 +42,7 @@ namespace OrientView
 
 		x264_t* encoder = nullptr;
 		x264_picture_t* convertedPicture = nullptr;
-		SwsContext* swsContext = nullptr;
+		FrameConverter frameConverter;
 		Mp4File* mp4File = nullptr;
 		int64_t frameNumber = 0;
 
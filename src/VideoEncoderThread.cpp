@@ -2,16 +2,14 @@
 // License: GPLv3, see the LICENSE file.
 
 #include "VideoEncoderThread.h"
-#include "VideoDecoder.h"
 #include "VideoEncoder.h"
 #include "RenderOffScreenThread.h"
 #include "FrameData.h"
 
 using namespace OrientView;
 
-void VideoEncoderThread::initialize(VideoDecoder* videoDecoder, VideoEncoder* videoEncoder, RenderOffScreenThread* renderOffScreenThread)
+void VideoEncoderThread::initialize(VideoEncoder* videoEncoder, RenderOffScreenThread* renderOffScreenThread)
 {
-	this->videoDecoder = videoDecoder;
 	this->videoEncoder = videoEncoder;
 	this->renderOffScreenThread = renderOffScreenThread;
 }
@@ -24,13 +22,15 @@ void VideoEncoderThread::run()
 	{
 		if (renderOffScreenThread->tryGetNextFrame(renderedFrameData, 100))
 		{
+			int64_t cumulativeNumber = renderedFrameData.cumulativeNumber;
+
 			videoEncoder->readFrameData(renderedFrameData);
-			renderOffScreenThread->signalFrameRead();
+			renderOffScreenThread->releaseFrame(renderedFrameData);
 			int frameSize = videoEncoder->encodeFrame();
 
-			emit frameProcessed(renderedFrameData.cumulativeNumber, frameSize);
+			emit frameProcessed(cumulativeNumber, frameSize);
 		}
-		else if (videoDecoder->getIsFinished())
+		else if (renderOffScreenThread->getIsFinished())
 			break;
 	}
 
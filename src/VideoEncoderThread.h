@@ -7,7 +7,6 @@
 
 namespace OrientView
 {
-	class VideoDecoder;
 	class VideoEncoder;
 	class RenderOffScreenThread;
 
@@ -18,7 +17,7 @@ namespace OrientView
 
 	public:
 
-		void initialize(VideoDecoder* videoDecoder, VideoEncoder* videoEncoder, RenderOffScreenThread* renderOffScreenThread);
+		void initialize(VideoEncoder* videoEncoder, RenderOffScreenThread* renderOffScreenThread);
 
 	signals:
 
@@ -31,7 +30,6 @@ namespace OrientView
 
 	private:
 
-		VideoDecoder* videoDecoder = nullptr;
 		VideoEncoder* videoEncoder = nullptr;
 		RenderOffScreenThread* renderOffScreenThread = nullptr;
 	};
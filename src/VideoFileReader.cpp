@@ -0,0 +1,266 @@
+// Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: GPLv3, see the LICENSE file.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+
+#include "VideoFileReader.h"
+#include "Settings.h"
+
+using namespace OrientView;
+
+bool VideoFileReader::initialize(const QString& fileName, Settings* settings)
+{
+	file.setFileName(fileName);
+
+	if (!file.open(QIODevice::ReadOnly))
+	{
+		qWarning("Could not open video file: %s", qPrintable(file.errorString()));
+		return false;
+	}
+
+	fileSize = file.size();
+	blockSize = 1024 * 1024;
+	readAheadBlockCount = std::max(1, settings->video.readAheadSize);
+
+#ifdef __linux__
+	// doubles the kernel read-ahead window and lets it drop the pages behind the reader sooner
+	posix_fadvise(file.handle(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	if (settings->video.useMemoryMapping && fileSize > 0)
+	{
+		mappedData = file.map(0, fileSize);
+
+		if (mappedData == nullptr)
+			qWarning("Could not memory map the video file, falling back to reading: %s", qPrintable(file.errorString()));
+#ifdef __linux__
+		else
+			posix_madvise(mappedData, (size_t)fileSize, POSIX_MADV_SEQUENTIAL);
+#endif
+	}
+
+	return true;
+}
+
+void VideoFileReader::stop()
+{
+	requestInterruption();
+
+	readerMutex.lock();
+	blockRequested.wakeAll();
+	blockLoaded.wakeAll();
+	readerMutex.unlock();
+
+	wait();
+
+	if (readTime > 0)
+		qDebug("Read %.1f MB at %.1f MB/s", bytesRead / (1024.0 * 1024.0), getReadThroughput());
+
+	if (mappedData != nullptr)
+	{
+		file.unmap(mappedData);
+		mappedData = nullptr;
+	}
+
+	blocks.clear();
+	file.close();
+}
+
+void VideoFileReader::run()
+{
+	// the mapping is read directly by the consumer
+	if (mappedData != nullptr)
+		return;
+
+	QElapsedTimer readTimer;
+
+	while (!isInterruptionRequested())
+	{
+		int64_t blockIndex = 0;
+
+		{
+			QMutexLocker locker(&readerMutex);
+
+			if (hasReadError || !tryGetMissingBlock(blockIndex))
+			{
+				blockRequested.wait(&readerMutex, 100);
+				continue;
+			}
+		}
+
+		// the file is only touched by this thread, so the read itself does not need the lock
+		int64_t blockOffset = blockIndex * blockSize;
+		std::vector<uint8_t> block((size_t)std::min(blockSize, fileSize - blockOffset));
+
+		readTimer.restart();
+		bool readSucceeded = file.seek(blockOffset) && file.read((char*)block.data(), (qint64)block.size()) == (qint64)block.size();
+		int64_t elapsedTime = readTimer.nsecsElapsed();
+
+		QMutexLocker locker(&readerMutex);
+
+		if (readSucceeded)
+		{
+			bytesRead += (int64_t)block.size();
+			readTime += elapsedTime;
+			blocks[blockIndex].swap(block);
+		}
+		else
+		{
+			qWarning("Could not read the video file at %lld: %s", (long long)blockOffset, qPrintable(file.errorString()));
+			hasReadError = true;
+		}
+
+		blockLoaded.wakeAll();
+	}
+}
+
+// Must be called with the reader mutex held. Also forgets the blocks that fell out of the read-ahead window.
+bool VideoFileReader::tryGetMissingBlock(int64_t& blockIndex)
+{
+	int64_t currentBlockIndex = position / blockSize;
+	int64_t lastBlockIndex = std::min(currentBlockIndex + (isReadAheadEnabled ? readAheadBlockCount : 1), (fileSize + blockSize - 1) / blockSize);
+
+	// keep the previous block around for the small backward seeks the demuxers do
+	auto block = blocks.begin();
+
+	while (block != blocks.end())
+	{
+		if (block->first < currentBlockIndex - 1 || block->first >= lastBlockIndex)
+			block = blocks.erase(block);
+		else
+			++block;
+	}
+
+	for (int64_t i = currentBlockIndex; i < lastBlockIndex; ++i)
+	{
+		if (blocks.count(i) == 0)
+		{
+			blockIndex = i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Returns the number of bytes copied, zero at the end of the file or -1 on a read error.
+int VideoFileReader::read(uint8_t* buffer, int size)
+{
+	if (mappedData != nullptr)
+	{
+		QMutexLocker locker(&readerMutex);
+
+		int count = (int)std::max((int64_t)0, std::min((int64_t)size, fileSize - position));
+
+		// the pages are read in from the disk during the copy, so it is what the throughput is measured from
+		QElapsedTimer readTimer;
+		readTimer.start();
+
+		memcpy(buffer, mappedData + position, (size_t)count);
+
+		readTime += readTimer.nsecsElapsed();
+		position += count;
+		bytesRead += count;
+
+		return count;
+	}
+
+	QMutexLocker locker(&readerMutex);
+
+	int count = 0;
+
+	while (count < size && position < fileSize)
+	{
+		auto block = blocks.find(position / blockSize);
+
+		if (block == blocks.end())
+		{
+			if (hasReadError || isInterruptionRequested())
+				return (count > 0) ? count : -1;
+
+			blockRequested.wakeAll();
+			blockLoaded.wait(&readerMutex, 100);
+
+			continue;
+		}
+
+		int64_t blockOffset = position - block->first * blockSize;
+		int64_t copyCount = std::min((int64_t)(size - count), (int64_t)block->second.size() - blockOffset);
+
+		memcpy(buffer + count, block->second.data() + blockOffset, (size_t)copyCount);
+		count += (int)copyCount;
+		position += copyCount;
+	}
+
+	// moves the read-ahead window along
+	blockRequested.wakeAll();
+
+	return count;
+}
+
+// Returns the new position or -1 if it would be outside the file.
+int64_t VideoFileReader::seek(int64_t offset, int whence)
+{
+	QMutexLocker locker(&readerMutex);
+
+	int64_t newPosition = 0;
+
+	switch (whence)
+	{
+		case SEEK_SET: newPosition = offset; break;
+		case SEEK_CUR: newPosition = position + offset; break;
+		case SEEK_END: newPosition = fileSize + offset; break;
+		default: return -1;
+	}
+
+	if (newPosition < 0)
+		return -1;
+
+	position = newPosition;
+	blockRequested.wakeAll();
+
+	return position;
+}
+
+// Without the read-ahead only the block under the read position is loaded.
+void VideoFileReader::setReadAheadEnabled(bool value)
+{
+	QMutexLocker locker(&readerMutex);
+
+	isReadAheadEnabled = value;
+	blockRequested.wakeAll();
+}
+
+int64_t VideoFileReader::getFileSize() const
+{
+	return fileSize;
+}
+
+int64_t VideoFileReader::getBytesRead()
+{
+	QMutexLocker locker(&readerMutex);
+	return bytesRead;
+}
+
+double VideoFileReader::getReadTime()
+{
+	QMutexLocker locker(&readerMutex);
+	return readTime / 1000000000.0;
+}
+
+double VideoFileReader::getReadThroughput()
+{
+	QMutexLocker locker(&readerMutex);
+
+	if (readTime <= 0)
+		return 0.0;
+
+	return (bytesRead / (1024.0 * 1024.0)) / (readTime / 1000000000.0);
+}
@@ -0,0 +1,65 @@
+// Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: GPLv3, see the LICENSE file.
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include <QThread>
+#include <QFile>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QElapsedTimer>
+
+namespace OrientView
+{
+	class Settings;
+
+	// Read the video file in large blocks on a thread ahead of the demuxer. Backs the FFmpeg I/O context.
+	class VideoFileReader : public QThread
+	{
+		Q_OBJECT
+
+	public:
+
+		bool initialize(const QString& fileName, Settings* settings);
+		void stop();
+
+		int read(uint8_t* buffer, int size);
+		int64_t seek(int64_t offset, int whence);
+		void setReadAheadEnabled(bool value);
+
+		int64_t getFileSize() const;
+		int64_t getBytesRead();
+		double getReadTime(); // seconds
+		double getReadThroughput(); // megabytes per second
+
+	protected:
+
+		void run();
+
+	private:
+
+		bool tryGetMissingBlock(int64_t& blockIndex);
+
+		QFile file;
+		int64_t fileSize = 0;
+		uchar* mappedData = nullptr;
+
+		QMutex readerMutex;
+		QWaitCondition blockRequested;
+		QWaitCondition blockLoaded;
+
+		std::map<int64_t, std::vector<uint8_t>> blocks; // keyed by the block index
+		int64_t position = 0;
+		int64_t blockSize = 0;
+		int64_t readAheadBlockCount = 0;
+		bool isReadAheadEnabled = false;
+		bool hasReadError = false;
+
+		int64_t bytesRead = 0;
+		int64_t readTime = 0; // nanoseconds spent in the file reads
+	};
+}
@@ -0,0 +1,344 @@
+// Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: GPLv3, see the LICENSE file.
+
+#include <QtGlobal>
+
+#include "VideoInput.h"
+#include "VideoFileReader.h"
+#include "Settings.h"
+
+using namespace OrientView;
+
+namespace
+{
+	int readFileCallback(void* opaque, uint8_t* buffer, int size)
+	{
+		int count = ((VideoFileReader*)opaque)->read(buffer, size);
+		return (count == 0) ? AVERROR_EOF : count;
+	}
+
+	int64_t seekFileCallback(void* opaque, int64_t offset, int whence)
+	{
+		VideoFileReader* videoFileReader = (VideoFileReader*)opaque;
+
+		if (whence == AVSEEK_SIZE)
+			return videoFileReader->getFileSize();
+
+		return videoFileReader->seek(offset, whence & ~AVSEEK_FORCE);
+	}
+}
+
+bool VideoInput::initialize(const QString& fileName, Settings* settings)
+{
+	qDebug("Opening video file (%s)", qPrintable(fileName));
+
+	this->fileName = fileName;
+
+	av_init_packet(&pendingPacket);
+	pendingPacket.data = nullptr;
+	pendingPacket.size = 0;
+
+	// large sequential reads ahead of the demuxer instead of the small reads of the file protocol
+	if (settings->video.readAheadSize > 0)
+	{
+		videoFileReader = new VideoFileReader();
+
+		if (!videoFileReader->initialize(fileName, settings))
+			return false;
+
+		videoFileReader->start();
+
+		const int ioBufferSize = 64 * 1024;
+		uint8_t* ioBuffer = (uint8_t*)av_malloc(ioBufferSize);
+
+		if (ioBuffer == nullptr)
+		{
+			qWarning("Could not allocate the I/O buffer");
+			return false;
+		}
+
+		ioContext = avio_alloc_context(ioBuffer, ioBufferSize, 0, videoFileReader, readFileCallback, nullptr, seekFileCallback);
+
+		if (ioContext == nullptr)
+		{
+			av_free(ioBuffer);
+			qWarning("Could not allocate the I/O context");
+			return false;
+		}
+
+		formatContext = avformat_alloc_context();
+
+		if (formatContext == nullptr)
+		{
+			qWarning("Could not allocate the format context");
+			return false;
+		}
+
+		formatContext->pb = ioContext;
+	}
+
+	if (avformat_open_input(&formatContext, fileName.toUtf8().constData(), nullptr, nullptr) < 0)
+	{
+		qWarning("Could not open source file");
+		return false;
+	}
+
+	if (avformat_find_stream_info(formatContext, nullptr) < 0)
+	{
+		qWarning("Could not find stream information");
+		return false;
+	}
+
+	videoStreamIndex = av_find_best_stream(formatContext, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+
+	if (videoStreamIndex < 0)
+	{
+		qWarning("Could not find video stream");
+		return false;
+	}
+
+	// the demuxer does not need to parse the packets of the other streams
+	for (unsigned int i = 0; i < formatContext->nb_streams; ++i)
+	{
+		if ((int)i != videoStreamIndex)
+			formatContext->streams[i]->discard = AVDISCARD_ALL;
+	}
+
+	videoStream = formatContext->streams[(size_t)videoStreamIndex];
+	streamStartTimestamp = (videoStream->start_time != AV_NOPTS_VALUE) ? videoStream->start_time : 0;
+
+	// a file alone is its own timeline
+	setTimeline(videoStream->time_base, streamStartTimestamp);
+
+	return true;
+}
+
+VideoInput::~VideoInput()
+{
+	freePendingPacket();
+
+	if (formatContext != nullptr)
+	{
+		avformat_close_input(&formatContext);
+		formatContext = nullptr;
+	}
+
+	if (ioContext != nullptr)
+	{
+		av_freep(&ioContext->buffer);
+		av_free(ioContext);
+		ioContext = nullptr;
+	}
+
+	if (videoFileReader != nullptr)
+	{
+		videoFileReader->stop();
+		delete videoFileReader;
+		videoFileReader = nullptr;
+	}
+}
+
+void VideoInput::setTimeline(AVRational timeBase, int64_t startTimestamp)
+{
+	timelineTimeBase = timeBase;
+	this->startTimestamp = startTimestamp;
+
+	if (videoStream->duration != AV_NOPTS_VALUE)
+		duration = av_rescale_q(videoStream->duration, videoStream->time_base, timelineTimeBase);
+	else if (formatContext->duration != AV_NOPTS_VALUE)
+		duration = av_rescale_q(formatContext->duration, AV_TIME_BASE_Q, timelineTimeBase);
+	else
+		duration = AV_NOPTS_VALUE;
+}
+
+// Appends the keyframe time stamps in the timeline time base.
+bool VideoInput::buildKeyframeIndex(std::vector<int64_t>& keyframeTimestamps)
+{
+	size_t previousCount = keyframeTimestamps.size();
+
+	// most containers (e.g. mp4) have a complete index right after opening
+	for (int i = 0; i < videoStream->nb_index_entries; ++i)
+	{
+		if (videoStream->index_entries[i].flags & AVINDEX_KEYFRAME)
+			keyframeTimestamps.push_back(getTimelineTimestamp(videoStream->index_entries[i].timestamp));
+	}
+
+	// otherwise read through the file once and collect the keyframe packets
+	if (keyframeTimestamps.size() == previousCount)
+	{
+		qDebug("Building keyframe index");
+
+		AVPacket packet;
+		av_init_packet(&packet);
+		packet.data = nullptr;
+		packet.size = 0;
+
+		setReadAheadEnabled(true);
+
+		while (av_read_frame(formatContext, &packet) >= 0)
+		{
+			if (packet.stream_index == videoStreamIndex && (packet.flags & AV_PKT_FLAG_KEY))
+			{
+				int64_t timestamp = (packet.pts != AV_NOPTS_VALUE) ? packet.pts : packet.dts;
+
+				if (timestamp != AV_NOPTS_VALUE)
+					keyframeTimestamps.push_back(getTimelineTimestamp(timestamp));
+			}
+
+			av_free_packet(&packet);
+		}
+
+		setReadAheadEnabled(false);
+
+		if (!seek((keyframeTimestamps.size() == previousCount) ? startTimestamp : keyframeTimestamps[previousCount], AVSEEK_FLAG_BACKWARD))
+		{
+			qWarning("Could not rewind video after indexing");
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Returns a negative error code (e.g. AVERROR_EOF) if there are no more video packets. The caller frees the packet.
+int VideoInput::readPacket(AVPacket& packet)
+{
+	if (hasPendingPacket)
+	{
+		packet = pendingPacket;
+		hasPendingPacket = false;
+
+		return 0;
+	}
+
+	while (true)
+	{
+		int readResult = av_read_frame(formatContext, &packet);
+
+		if (readResult < 0)
+			return readResult;
+
+		if (packet.stream_index == videoStreamIndex)
+			break;
+
+		av_free_packet(&packet);
+	}
+
+	packet.pts = getTimelineTimestamp(packet.pts);
+	packet.dts = getTimelineTimestamp(packet.dts);
+	packet.duration = (int)av_rescale_q(packet.duration, videoStream->time_base, timelineTimeBase);
+
+	return 0;
+}
+
+bool VideoInput::seek(int64_t timestamp, int flags)
+{
+	freePendingPacket();
+
+	return (av_seek_frame(formatContext, videoStreamIndex, getStreamTimestamp(timestamp), flags) >= 0);
+}
+
+// Rewinds to the start and reads the first packet, which also gets the file reader going from the right place.
+bool VideoInput::prefetch()
+{
+	if (hasPendingPacket)
+		return true;
+
+	if (!seek(startTimestamp, AVSEEK_FLAG_BACKWARD))
+		return false;
+
+	if (readPacket(pendingPacket) < 0)
+		return false;
+
+	if (av_dup_packet(&pendingPacket) < 0)
+	{
+		av_free_packet(&pendingPacket);
+		return false;
+	}
+
+	hasPendingPacket = true;
+
+	return true;
+}
+
+void VideoInput::setReadAheadEnabled(bool value)
+{
+	if (videoFileReader != nullptr)
+		videoFileReader->setReadAheadEnabled(value);
+}
+
+QString VideoInput::getFileName() const
+{
+	return fileName;
+}
+
+AVFormatContext* VideoInput::getFormatContext() const
+{
+	return formatContext;
+}
+
+AVStream* VideoInput::getVideoStream() const
+{
+	return videoStream;
+}
+
+int64_t VideoInput::getStartTimestamp() const
+{
+	return startTimestamp;
+}
+
+int64_t VideoInput::getEndTimestamp() const
+{
+	if (duration == AV_NOPTS_VALUE)
+		return AV_NOPTS_VALUE;
+
+	return startTimestamp + duration;
+}
+
+int64_t VideoInput::getDuration() const
+{
+	return duration;
+}
+
+int64_t VideoInput::getFrameCount() const
+{
+	return videoStream->nb_frames;
+}
+
+int64_t VideoInput::getBytesRead() const
+{
+	if (videoFileReader == nullptr)
+		return 0;
+
+	return videoFileReader->getBytesRead();
+}
+
+double VideoInput::getReadTime() const
+{
+	if (videoFileReader == nullptr)
+		return 0.0;
+
+	return videoFileReader->getReadTime();
+}
+
+int64_t VideoInput::getTimelineTimestamp(int64_t timestamp) const
+{
+	if (timestamp == AV_NOPTS_VALUE)
+		return AV_NOPTS_VALUE;
+
+	return av_rescale_q(timestamp - streamStartTimestamp, videoStream->time_base, timelineTimeBase) + startTimestamp;
+}
+
+int64_t VideoInput::getStreamTimestamp(int64_t timestamp) const
+{
+	return av_rescale_q(timestamp - startTimestamp, timelineTimeBase, videoStream->time_base) + streamStartTimestamp;
+}
+
+void VideoInput::freePendingPacket()
+{
+	if (hasPendingPacket)
+	{
+		av_free_packet(&pendingPacket);
+		hasPendingPacket = false;
+	}
+}
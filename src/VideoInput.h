@@ -0,0 +1,71 @@
+// Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: GPLv3, see the LICENSE file.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <QString>
+
+extern "C"
+{
+#include "libavformat/avformat.h"
+}
+
+namespace OrientView
+{
+	class Settings;
+	class VideoFileReader;
+
+	// One video file placed on the continuous timeline of all the input files.
+	// The packets and the time stamps going in and out are in the timeline time base.
+	class VideoInput
+	{
+
+	public:
+
+		bool initialize(const QString& fileName, Settings* settings);
+		~VideoInput();
+
+		void setTimeline(AVRational timeBase, int64_t startTimestamp);
+		bool buildKeyframeIndex(std::vector<int64_t>& keyframeTimestamps);
+
+		int readPacket(AVPacket& packet);
+		bool seek(int64_t timestamp, int flags);
+		bool prefetch();
+		void setReadAheadEnabled(bool value);
+
+		QString getFileName() const;
+		AVFormatContext* getFormatContext() const;
+		AVStream* getVideoStream() const;
+		int64_t getStartTimestamp() const;
+		int64_t getEndTimestamp() const;
+		int64_t getDuration() const;
+		int64_t getFrameCount() const;
+		int64_t getBytesRead() const;
+		double getReadTime() const;
+
+	private:
+
+		int64_t getTimelineTimestamp(int64_t timestamp) const;
+		int64_t getStreamTimestamp(int64_t timestamp) const;
+		void freePendingPacket();
+
+		QString fileName;
+
+		VideoFileReader* videoFileReader = nullptr;
+		AVIOContext* ioContext = nullptr;
+		AVFormatContext* formatContext = nullptr;
+		AVStream* videoStream = nullptr;
+		int videoStreamIndex = 0;
+
+		AVRational timelineTimeBase = { 1, 1 };
+		int64_t streamStartTimestamp = 0; // video stream time base units
+		int64_t startTimestamp = 0; // timeline time base units
+		int64_t duration = AV_NOPTS_VALUE; // timeline time base units
+
+		AVPacket pendingPacket; // the first packet, read ahead of time so the file is ready when the timeline gets here
+		bool hasPendingPacket = false;
+	};
+}
@@ -10,6 +10,9 @@
 #include "VideoStabilizer.h"
 #include "Settings.h"
 #include "FrameData.h"
+#include "FramePositionSmoother.h"
+#include "VideoDecoder.h"
+#include "GyroDataReader.h"
 
 #define sign(a) (((a) < 0) ? -1 : ((a) > 0))
 
@@ -25,6 +28,12 @@ bool VideoStabilizer::initialize(Settings* settings, bool isPreprocessing)
 	dampingFactor = settings->stabilizer.dampingFactor;
 	maxDisplacementFactor = settings->stabilizer.maxDisplacementFactor;
 	maxAngle = settings->stabilizer.maxAngle;
+	smoothingRadius = std::max(0, settings->stabilizer.smoothingRadius);
+	motionSource = settings->stabilizer.motionSource;
+	motionEstimationInterval = std::max(1, settings->stabilizer.motionEstimationInterval);
+	motionEstimationThreshold = settings->stabilizer.motionEstimationThreshold;
+
+	featureTracker.initialize(200, 0.5, settings->stabilizer.trackingThreadCount);
 
 	reset();
 
@@ -32,18 +41,69 @@ bool VideoStabilizer::initialize(Settings* settings, bool isPreprocessing)
 	{
 		if (!readNormalizedFramePositions(settings->stabilizer.inputDataFilePath))
 			return false;
+
+		if (normalizedDataFile.getFramePositions() != nullptr && !normalizedDataFile.isFromSource(settings->video.inputVideoFilePath))
+			qWarning("Stabilizer data was made from a different video (%s)", normalizedDataFile.getHeader().sourceFileName);
+	}
+
+	if (!isPreprocessing && mode == VideoStabilizerMode::Gyro)
+	{
+		if (!readGyroFramePositions(settings))
+			return false;
 	}
 
 	return true;
 }
 
-void VideoStabilizer::preProcessFrame(const FrameData& frameDataGrayscale, QFile& file)
+// The positions come out a couple of estimated frames late, when the spline through the skipped frames can be drawn.
+// The last frame of a part is always estimated, so the parts can be joined exactly.
+void VideoStabilizer::preProcessFrame(const FrameData& frameDataGrayscale, bool isLastFrame, std::vector<FramePosition>& framePositions)
+{
+	if (isLastFrame || getIsMotionEstimationNeeded())
+	{
+		KeyFramePosition keyFramePosition;
+		keyFramePosition.frameIndex = preProcessedFrameCount;
+		keyFramePosition.framePosition = estimateFramePosition(frameDataGrayscale);
+
+		keyFramePositions.push_back(keyFramePosition);
+		pendingFramePositions.push_back(keyFramePosition.framePosition);
+	}
+	else
+		pendingFramePositions.push_back(skipFramePosition(frameDataGrayscale));
+
+	preProcessedFrameCount++;
+
+	// the interval before the last one has the key frames on both sides of it for the tangents
+	if (keyFramePositions.size() >= 3)
+	{
+		writeInterpolatedFramePositions(keyFramePositions.size() - 3, framePositions);
+
+		if (keyFramePositions.size() > 3)
+			keyFramePositions.erase(keyFramePositions.begin());
+	}
+}
+
+void VideoStabilizer::finishPreProcessing(std::vector<FramePosition>& framePositions)
 {
-	FramePosition cumulativeFramePosition = calculateCumulativeFramePosition(frameDataGrayscale);
+	if (keyFramePositions.size() >= 2)
+		writeInterpolatedFramePositions(keyFramePositions.size() - 2, framePositions);
+
+	// the frames after the last estimate continue with its motion
+	for (size_t i = 0; i < pendingFramePositions.size() && !keyFramePositions.empty(); ++i)
+	{
+		FramePosition fp = keyFramePositions.back().framePosition;
 
-	char buffer[1024];
-	sprintf(buffer, "%lld;%.16le;%.16le;%.16le\n", (long long int)cumulativeFramePosition.timeStamp, cumulativeFramePosition.x, cumulativeFramePosition.y, cumulativeFramePosition.angle);
-	file.write(buffer);
+		fp.timeStamp = pendingFramePositions[i].timeStamp;
+		fp.x += motionPerFrame.x * i;
+		fp.y += motionPerFrame.y * i;
+		fp.angle += motionPerFrame.angle * i;
+
+		framePositions.push_back(fp);
+	}
+
+	keyFramePositions.clear();
+	pendingFramePositions.clear();
+	preProcessedFrameCount = 0;
 }
 
 void VideoStabilizer::processFrame(const FrameData& frameDataGrayscale)
@@ -51,13 +111,23 @@ void VideoStabilizer::processFrame(const FrameData& frameDataGrayscale)
 	if (!isEnabled)
 		return;
 
+	// frames decoded while the stabilizer was disabled come without the image
+	if ((mode == VideoStabilizerMode::RealTime || mode == VideoStabilizerMode::Lookahead) && frameDataGrayscale.data == nullptr)
+	{
+		isFirstImage = true;
+		return;
+	}
+
 	processTimer.restart();
 
 	if (mode == VideoStabilizerMode::Preprocessed)
 		normalizedFramePosition = searchNormalizedFramePosition(frameDataGrayscale);
+	else if (mode == VideoStabilizerMode::Gyro)
+		normalizedFramePosition = searchGyroFramePosition(frameDataGrayscale);
 	else
 	{
-		FramePosition cumulativeFramePosition = calculateCumulativeFramePosition(frameDataGrayscale);
+		// there are no future frames to interpolate to, so the skipped frames are predicted from the last motion
+		FramePosition cumulativeFramePosition = getIsMotionEstimationNeeded() ? estimateFramePosition(frameDataGrayscale) : skipFramePosition(frameDataGrayscale);
 
 		normalizedFramePosition.x = cumulativeXAverage.getAverage() - cumulativeFramePosition.x;
 		normalizedFramePosition.y = cumulativeYAverage.getAverage() - cumulativeFramePosition.y;
@@ -68,6 +138,70 @@ void VideoStabilizer::processFrame(const FrameData& frameDataGrayscale)
 		cumulativeAngleAverage.addMeasurement(cumulativeFramePosition.angle);
 	}
 
+	limitNormalizedFramePosition();
+
+	lastProcessTime = processTimer.nsecsElapsed() / 1000000.0;
+}
+
+// In the lookahead mode the export holds the decoded frames back by the smoothing radius, so the frame coming out has the future frames around it.
+// Playing on the screen cannot wait for the future, it stabilizes the frames like the real-time mode does.
+void VideoStabilizer::addLookaheadFrame(const FrameData& frameDataGrayscale)
+{
+	processTimer.restart();
+
+	FramePosition cumulativeFramePosition = getIsMotionEstimationNeeded() ? estimateFramePosition(frameDataGrayscale) : skipFramePosition(frameDataGrayscale);
+
+	lookaheadFramePositions.push_back(cumulativeFramePosition);
+	lookaheadSum.x += cumulativeFramePosition.x;
+	lookaheadSum.y += cumulativeFramePosition.y;
+	lookaheadSum.angle += cumulativeFramePosition.angle;
+
+	lastProcessTime = processTimer.nsecsElapsed() / 1000000.0;
+}
+
+// Gives the position of the oldest frame not processed yet, with the average of the frames within the smoothing radius on both sides of it.
+// At the end of the video there are fewer frames after it, the window is then cut short.
+void VideoStabilizer::processLookaheadFrame()
+{
+	size_t index = (size_t)(lookaheadOutputIndex - lookaheadFirstIndex);
+
+	if (index >= lookaheadFramePositions.size())
+		return;
+
+	const FramePosition& cumulativeFramePosition = lookaheadFramePositions[index];
+	double count = (double)lookaheadFramePositions.size();
+
+	normalizedFramePosition.timeStamp = cumulativeFramePosition.timeStamp;
+	normalizedFramePosition.x = lookaheadSum.x / count - cumulativeFramePosition.x;
+	normalizedFramePosition.y = lookaheadSum.y / count - cumulativeFramePosition.y;
+	normalizedFramePosition.angle = lookaheadSum.angle / count - cumulativeFramePosition.angle;
+
+	limitNormalizedFramePosition();
+
+	lookaheadOutputIndex++;
+
+	// the window slides on when the oldest frame falls out of the radius of the next one
+	if (lookaheadOutputIndex - lookaheadFirstIndex > smoothingRadius)
+	{
+		const FramePosition& firstFramePosition = lookaheadFramePositions.front();
+
+		lookaheadSum.x -= firstFramePosition.x;
+		lookaheadSum.y -= firstFramePosition.y;
+		lookaheadSum.angle -= firstFramePosition.angle;
+
+		lookaheadFramePositions.pop_front();
+		lookaheadFirstIndex++;
+	}
+}
+
+// The number of frames the export has to hold back before processing the oldest one.
+int VideoStabilizer::getLookaheadFrameCount() const
+{
+	return (isEnabled && mode == VideoStabilizerMode::Lookahead) ? smoothingRadius : 0;
+}
+
+void VideoStabilizer::limitNormalizedFramePosition()
+{
 	normalizedFramePosition.x *= dampingFactor;
 	normalizedFramePosition.y *= dampingFactor;
 	normalizedFramePosition.angle *= dampingFactor;
@@ -75,55 +209,202 @@ void VideoStabilizer::processFrame(const FrameData& frameDataGrayscale)
 	normalizedFramePosition.x = std::max(-maxDisplacementFactor, std::min(normalizedFramePosition.x, maxDisplacementFactor));
 	normalizedFramePosition.y = std::max(-maxDisplacementFactor, std::min(normalizedFramePosition.y, maxDisplacementFactor));
 	normalizedFramePosition.angle = std::max(-maxAngle, std::min(normalizedFramePosition.angle, maxAngle));
+}
 
-	lastProcessTime = processTimer.nsecsElapsed() / 1000000.0;
+// The motion vectors come with every frame, so only the image analysis is subsampled.
+bool VideoStabilizer::getIsMotionEstimationNeeded() const
+{
+	if (isFirstImage || motionEstimationInterval <= 1 || motionSource == StabilizerMotionSource::MotionVectors)
+		return true;
+
+	int64_t frameCount = skippedFrameCount + 1;
+
+	if (frameCount >= motionEstimationInterval)
+		return true;
+
+	// fast motion is estimated sooner, so the larger steps do not get lost between the estimates
+	if (motionEstimationThreshold > 0.0)
+	{
+		double predictedX = motionPerFrame.x * frameCount;
+		double predictedY = motionPerFrame.y * frameCount;
+
+		if (sqrt(predictedX * predictedX + predictedY * predictedY) >= motionEstimationThreshold)
+			return true;
+	}
+
+	return false;
 }
 
-FramePosition VideoStabilizer::calculateCumulativeFramePosition(const FrameData& frameDataGrayscale)
+FramePosition VideoStabilizer::estimateFramePosition(const FrameData& frameDataGrayscale)
 {
-	cv::Mat currentImage(frameDataGrayscale.height, frameDataGrayscale.width, CV_8UC1, frameDataGrayscale.data);
+	bool hasPreviousEstimate = !isFirstImage;
+	FramePosition fp = calculateCumulativeFramePosition(frameDataGrayscale);
 
-	if (isFirstImage)
+	if (hasPreviousEstimate)
 	{
-		previousImage = cv::Mat(frameDataGrayscale.height, frameDataGrayscale.width, CV_8UC1);
-		currentImage.copyTo(previousImage);
-		isFirstImage = false;
+		double frameCount = (double)(skippedFrameCount + 1);
+
+		motionPerFrame.x = (fp.x - lastEstimatedFramePosition.x) / frameCount;
+		motionPerFrame.y = (fp.y - lastEstimatedFramePosition.y) / frameCount;
+		motionPerFrame.angle = (fp.angle - lastEstimatedFramePosition.angle) / frameCount;
 	}
+	else
+		motionPerFrame = FramePosition();
+
+	lastEstimatedFramePosition = fp;
+	skippedFrameCount = 0;
+
+	return fp;
+}
+
+FramePosition VideoStabilizer::skipFramePosition(const FrameData& frameDataGrayscale)
+{
+	skippedFrameCount++;
+
+	FramePosition fp = lastEstimatedFramePosition;
+	fp.timeStamp = frameDataGrayscale.timeStamp;
+	fp.x += motionPerFrame.x * skippedFrameCount;
+	fp.y += motionPerFrame.y * skippedFrameCount;
+	fp.angle += motionPerFrame.angle * skippedFrameCount;
+
+	return fp;
+}
+
+// Central difference of the key frames around the given one, or one-sided at the ends.
+FramePosition VideoStabilizer::getKeyFrameTangent(size_t index) const
+{
+	const KeyFramePosition& first = keyFramePositions[(index > 0) ? index - 1 : index];
+	const KeyFramePosition& last = keyFramePositions[(index + 1 < keyFramePositions.size()) ? index + 1 : index];
+
+	FramePosition tangent;
+	double frameCount = (double)(last.frameIndex - first.frameIndex);
+
+	if (frameCount > 0.0)
+	{
+		tangent.x = (last.framePosition.x - first.framePosition.x) / frameCount;
+		tangent.y = (last.framePosition.y - first.framePosition.y) / frameCount;
+		tangent.angle = (last.framePosition.angle - first.framePosition.angle) / frameCount;
+	}
+
+	return tangent;
+}
+
+// Writes the frames from the given key frame up to the next one, the skipped ones on a cubic Hermite spline through the key frames.
+void VideoStabilizer::writeInterpolatedFramePositions(size_t index, std::vector<FramePosition>& framePositions)
+{
+	const KeyFramePosition& start = keyFramePositions[index];
+	const KeyFramePosition& end = keyFramePositions[index + 1];
+
+	FramePosition startTangent = getKeyFrameTangent(index);
+	FramePosition endTangent = getKeyFrameTangent(index + 1);
 
-	std::vector<cv::Point2f> previousCorners;
-	std::vector<cv::Point2f> previousCornersFiltered;
-	std::vector<cv::Point2f> currentCorners;
-	std::vector<cv::Point2f> currentCornersFiltered;
-	std::vector<uchar> opticalFlowStatus;
-	std::vector<float> opticalFlowError;
+	int64_t frameCount = end.frameIndex - start.frameIndex;
+	double h = (double)frameCount;
 
-	// find good trackable feature points from the previous image
-	cv::goodFeaturesToTrack(previousImage, previousCorners, 200, 0.01, 30.0);
+	for (int64_t i = 0; i < frameCount; ++i)
+	{
+		double s = i / h;
+		double h00 = (2.0 * s - 3.0) * s * s + 1.0;
+		double h10 = ((s - 2.0) * s + 1.0) * s;
+		double h01 = (3.0 - 2.0 * s) * s * s;
+		double h11 = (s - 1.0) * s * s;
+
+		FramePosition fp;
+		fp.timeStamp = pendingFramePositions[(size_t)i].timeStamp;
+		fp.x = h00 * start.framePosition.x + h10 * h * startTangent.x + h01 * end.framePosition.x + h11 * h * endTangent.x;
+		fp.y = h00 * start.framePosition.y + h10 * h * startTangent.y + h01 * end.framePosition.y + h11 * h * endTangent.y;
+		fp.angle = h00 * start.framePosition.angle + h10 * h * startTangent.angle + h01 * end.framePosition.angle + h11 * h * endTangent.angle;
+
+		framePositions.push_back(fp);
+	}
 
-	// find those same points in the current image
-	cv::calcOpticalFlowPyrLK(previousImage, currentImage, previousCorners, currentCorners, opticalFlowStatus, opticalFlowError);
+	pendingFramePositions.erase(pendingFramePositions.begin(), pendingFramePositions.begin() + (size_t)frameCount);
+}
 
-	currentImage.copyTo(previousImage);
+FramePosition VideoStabilizer::calculateCumulativeFramePosition(const FrameData& frameDataGrayscale)
+{
+	cv::Mat currentImage(frameDataGrayscale.height, frameDataGrayscale.width, CV_8UC1, frameDataGrayscale.data);
+	cv::Mat currentTransformation;
 
-	// filter out points which didn't have a good match
-	for (size_t i = 0; i < opticalFlowStatus.size(); i++)
+	if (motionSource == StabilizerMotionSource::MotionVectors)
 	{
-		if (opticalFlowStatus.at(i) != 0)
+		if (frameDataGrayscale.hasMotion && !isFirstImage)
+		{
+			// the image is only copied when the decoder expects the next frame to need it for the tracking
+			hasPreviousImage = !frameDataGrayscale.hasNextMotion;
+			isPreviousImageTracked = false;
+			isFirstImage = false;
+
+			if (hasPreviousImage)
+				currentImage.copyTo(previousImage);
+
+			return addFramePosition(frameDataGrayscale, frameDataGrayscale.motionX, frameDataGrayscale.motionY, frameDataGrayscale.motionAngle);
+		}
+
+		// the images are only tracked when the decoder has no motion vectors (e.g. on the intra and bidirectional frames)
+		if (!isFirstImage && !isPreviousImageTracked)
 		{
-			previousCornersFiltered.push_back(previousCorners.at(i));
-			currentCornersFiltered.push_back(currentCorners.at(i));
+			featureTracker.reset();
+
+			if (hasPreviousImage && previousImage.size() == currentImage.size())
+				featureTracker.track(previousImage);
+			else
+			{
+				// an unexpected frame without the motion vectors, so it is taken to move like the previous one
+				featureTracker.track(currentImage);
+				isPreviousImageTracked = true;
+
+				return addFramePosition(frameDataGrayscale, previousMotion.x, previousMotion.y, previousMotion.angle);
+			}
 		}
+
+		// the following frames without motion vectors continue from the tracker
+		isPreviousImageTracked = true;
 	}
 
-	cv::Mat currentTransformation;
+	if (motionSource == StabilizerMotionSource::PhaseCorrelation)
+	{
+		if (isFirstImage)
+			phaseCorrelator.reset();
+
+		double tx = 0.0;
+		double ty = 0.0;
 
-	// estimate the transformation between previous and current images trackable points
-	if (previousCornersFiltered.size() > 0 && currentCornersFiltered.size() > 0)
-		currentTransformation = cv::estimateRigidTransform(previousCornersFiltered, currentCornersFiltered, false);
+		// only the translation is measured, which is most of the shake in running footage
+		if (phaseCorrelator.estimate(currentImage, tx, ty))
+			currentTransformation = (cv::Mat_<double>(2, 3) << 1.0, 0.0, tx, 0.0, 1.0, ty);
+		else if (isFirstImage)
+			currentTransformation = cv::Mat::eye(2, 3, CV_64F);
+		else
+			previousTransformation.copyTo(currentTransformation);
 
-	// sometimes the transformation could not be found, just use previous transformation
-	if (currentTransformation.data == nullptr)
-		previousTransformation.copyTo(currentTransformation);
+		isFirstImage = false;
+	}
+	else if (isFirstImage)
+	{
+		featureTracker.reset();
+		featureTracker.track(currentImage);
+		isFirstImage = false;
+
+		// nothing to compare the first image to, so it has not moved
+		currentTransformation = cv::Mat::eye(2, 3, CV_64F);
+	}
+	else
+	{
+		// find the points tracked from the previous image in the current image
+		featureTracker.track(currentImage);
+
+		const std::vector<cv::Point2f>& previousPoints = featureTracker.getPreviousPoints();
+		const std::vector<cv::Point2f>& currentPoints = featureTracker.getCurrentPoints();
+
+		// estimate the transformation between previous and current images trackable points
+		if (previousPoints.size() > 0 && currentPoints.size() > 0)
+			currentTransformation = cv::estimateRigidTransform(previousPoints, currentPoints, false);
+
+		// sometimes the transformation could not be found, just use previous transformation
+		if (currentTransformation.data == nullptr)
+			previousTransformation.copyTo(currentTransformation);
+	}
 
 	// a b tx
 	// c d ty
@@ -138,10 +419,19 @@ FramePosition VideoStabilizer::calculateCumulativeFramePosition(const FrameData&
 	double deltaY = ty / frameDataGrayscale.height;
 	double deltaAngle = atan2(c, d) * 180.0 / M_PI;
 
+	return addFramePosition(frameDataGrayscale, deltaX, deltaY, deltaAngle);
+}
+
+FramePosition VideoStabilizer::addFramePosition(const FrameData& frameDataGrayscale, double deltaX, double deltaY, double deltaAngle)
+{
 	cumulativeX += deltaX;
 	cumulativeY += deltaY;
 	cumulativeAngle += deltaAngle;
 
+	previousMotion.x = deltaX;
+	previousMotion.y = deltaY;
+	previousMotion.angle = deltaAngle;
+
 	FramePosition fp;
 	fp.timeStamp = frameDataGrayscale.timeStamp;
 	fp.x = cumulativeX;
@@ -156,88 +446,198 @@ FramePosition VideoStabilizer::searchNormalizedFramePosition(const FrameData& fr
 	FramePosition result;
 
 	auto comparator = [](const OrientView::FramePosition& fp, const int64_t timeStamp) { return fp.timeStamp < timeStamp; };
-	auto searchResult = std::lower_bound(normalizedFramePositions.begin(), normalizedFramePositions.end(), frameDataGrayscale.timeStamp, comparator);
+	const FramePosition* framePositionsEnd = normalizedFramePositions + normalizedFramePositionCount;
+	const FramePosition* searchResult = std::lower_bound(normalizedFramePositions, framePositionsEnd, frameDataGrayscale.timeStamp, comparator);
 
-	if (searchResult != normalizedFramePositions.end() && (*searchResult).timeStamp >= frameDataGrayscale.timeStamp)
+	if (searchResult != framePositionsEnd && (*searchResult).timeStamp >= frameDataGrayscale.timeStamp)
 		result = *searchResult;
 
 	return result;
 }
 
-void VideoStabilizer::convertCumulativeFramePositionsToNormalized(QFile& fileIn, QFile& fileOut, int smoothingRadius)
+FramePosition VideoStabilizer::searchGyroFramePosition(const FrameData& frameDataGrayscale)
 {
-	QTextStream fileInStream(&fileIn);
-	QString fileInString = fileInStream.readAll();
+	if (gyroFramePositions.empty())
+		return FramePosition();
 
-	std::vector<FramePosition> positions;
+	int64_t index = (int64_t)(frameDataGrayscale.time * gyroFrameRate + 0.5);
+	index = std::max((int64_t)0, std::min(index, (int64_t)gyroFramePositions.size() - 1));
 
-	QStringList lines = fileInString.split('\n');
+	return gyroFramePositions[(size_t)index];
+}
 
-	for (int i = 1; i < lines.size(); ++i)
+// Integrates the camera rotation from the gyro samples to the frame times and smooths it like the pass two does.
+// The rotation around the vertical and the horizontal axis moves the image sideways and up or down, the roll turns it.
+bool VideoStabilizer::readGyroFramePositions(Settings* settings)
+{
+	GyroDataReader gyroDataReader;
+
+	if (!gyroDataReader.initialize(settings->video.inputVideoFilePath, settings->stabilizer.gyroOrientation))
+		return false;
+
+	if (gyroDataReader.getFrameRate() <= 0.0)
 	{
-		QStringList parts = lines.at(i).split(';');
+		qWarning("Could not find the video frame rate for the gyro data");
+		return false;
+	}
 
-		if (parts.size() == 4)
-		{
-			FramePosition fp;
+	// the angles at the sample times
+	std::vector<GyroSample> angles = gyroDataReader.getGyroAngles();
 
-			fp.timeStamp = (int64_t)parts[0].toLongLong();
-			fp.x = parts[1].toDouble();
-			fp.y = parts[2].toDouble();
-			fp.angle = parts[3].toDouble();
+	// an angle turns to the distance of the focal length times the angle on the image, relative to the frame size
+	double focalLengthFactor = 0.5 / tan(settings->stabilizer.gyroFieldOfView * M_PI / 360.0);
+	double aspectRatio = (gyroDataReader.getFrameHeight() > 0) ? (double)gyroDataReader.getFrameWidth() / gyroDataReader.getFrameHeight() : 16.0 / 9.0;
 
-			positions.push_back(fp);
-		}
+	gyroFrameRate = gyroDataReader.getFrameRate();
+	size_t frameCount = (size_t)(gyroDataReader.getDuration() * gyroFrameRate) + 1;
+
+	std::vector<FramePosition> cumulativeFramePositions(frameCount);
+	size_t sampleIndex = 0;
+
+	for (size_t i = 0; i < frameCount; ++i)
+	{
+		double time = i / gyroFrameRate + settings->stabilizer.gyroTimeOffset;
+
+		while (sampleIndex + 2 < angles.size() && angles[sampleIndex + 1].time <= time)
+			sampleIndex++;
+
+		const GyroSample& angle0 = angles[sampleIndex];
+		const GyroSample& angle1 = angles[sampleIndex + 1];
+		double alpha = (angle1.time > angle0.time) ? (time - angle0.time) / (angle1.time - angle0.time) : 0.0;
+		alpha = std::max(0.0, std::min(alpha, 1.0));
+
+		FramePosition& fp = cumulativeFramePositions[i];
+		fp.timeStamp = (int64_t)i;
+		fp.x = -(angle0.y + alpha * (angle1.y - angle0.y)) * focalLengthFactor;
+		fp.y = (angle0.x + alpha * (angle1.x - angle0.x)) * focalLengthFactor * aspectRatio;
+		fp.angle = -(angle0.z + alpha * (angle1.z - angle0.z)) * 180.0 / M_PI;
 	}
 
-	fileOut.write("timeStamp;cumulativeX;averageX;normalizedX;cumulativeY;averageY;normalizedY;cumulativeAngle;averageAngle;normalizedAngle\n");
+	FramePositionSmoother framePositionSmoother;
+	framePositionSmoother.initialize(cumulativeFramePositions.data(), frameCount, settings->stabilizer.smoothingType, settings->stabilizer.smoothingRadius);
+
+	gyroFramePositions.resize(frameCount);
 
-	for (int i = 0; i < (int)positions.size(); ++i)
+	for (size_t i = 0; i < frameCount; ++i)
 	{
-		double sumX = 0.0;
-		double sumY = 0.0;
-		double sumAngle = 0.0;
-		int sumCount = 0;
+		FramePosition averageFp = framePositionSmoother.getNextAverage();
+		FramePosition& normalizedFp = gyroFramePositions[i];
 
-		for (int j = -smoothingRadius; j <= smoothingRadius; ++j)
-		{
-			if ((i + j) >= 0 && (i + j) < (int)positions.size())
-			{
-				FramePosition fp = positions.at(i + j);
+		normalizedFp.timeStamp = cumulativeFramePositions[i].timeStamp;
+		normalizedFp.x = averageFp.x - cumulativeFramePositions[i].x;
+		normalizedFp.y = averageFp.y - cumulativeFramePositions[i].y;
+		normalizedFp.angle = averageFp.angle - cumulativeFramePositions[i].angle;
+	}
+
+	return true;
+}
 
-				sumX += fp.x;
-				sumY += fp.y;
-				sumAngle += fp.angle;
+// The input can be either a binary or a CSV file, the output is written as CSV if the file name ends with .csv.
+bool VideoStabilizer::convertCumulativeFramePositionsToNormalized(const QString& inputFileName, const QString& outputFileName, StabilizerSmoothingType smoothingType, int smoothingRadius)
+{
+	StabilizationDataFile inputDataFile;
+	std::vector<FramePosition> csvFramePositions;
+	StabilizationDataHeader sourceHeader = StabilizationDataFile::getSourceHeader(QString(), 0, 0);
 
-				sumCount++;
-			}
-		}
+	const FramePosition* positions = nullptr;
+	size_t positionCount = 0;
+
+	if (StabilizationDataFile::isBinaryFile(inputFileName))
+	{
+		if (!inputDataFile.open(inputFileName, StabilizationDataType::CumulativeFramePositions))
+			return false;
+
+		sourceHeader = inputDataFile.getHeader();
+		positions = inputDataFile.getFramePositions();
+		positionCount = inputDataFile.getFramePositionCount();
+	}
+	else
+	{
+		if (!readCsvFramePositions(inputFileName, 4, 1, 2, 3, csvFramePositions))
+			return false;
 
-		double averageX = 0.0;
-		double averageY = 0.0;
-		double averageAngle = 0.0;
+		positions = csvFramePositions.data();
+		positionCount = csvFramePositions.size();
+	}
+
+	bool isCsvOutput = StabilizationDataFile::isCsvFileName(outputFileName);
+	StabilizationDataFile outputDataFile;
+	QFile csvFile(outputFileName);
 
-		if (sumCount > 0)
+	if (isCsvOutput)
+	{
+		if (!csvFile.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
 		{
-			averageX = sumX / (double)sumCount;
-			averageY = sumY / (double)sumCount;
-			averageAngle = sumAngle / (double)sumCount;
+			qWarning("Could not open output file");
+			return false;
 		}
-		
-		FramePosition currentFp = positions.at(i);
+
+		csvFile.write("timeStamp;cumulativeX;averageX;normalizedX;cumulativeY;averageY;normalizedY;cumulativeAngle;averageAngle;normalizedAngle\n");
+	}
+	else if (!outputDataFile.create(outputFileName, StabilizationDataType::NormalizedFramePositions, sourceHeader))
+		return false;
+
+	FramePositionSmoother framePositionSmoother;
+	framePositionSmoother.initialize(positions, positionCount, smoothingType, smoothingRadius);
+
+	for (size_t i = 0; i < positionCount; ++i)
+	{
+		FramePosition averageFp = framePositionSmoother.getNextAverage();
+		double averageX = averageFp.x;
+		double averageY = averageFp.y;
+		double averageAngle = averageFp.angle;
+
+		const FramePosition& currentFp = positions[i];
 		FramePosition normalizedFp;
 
+		normalizedFp.timeStamp = currentFp.timeStamp;
 		normalizedFp.x = averageX - currentFp.x;
 		normalizedFp.y = averageY - currentFp.y;
 		normalizedFp.angle = averageAngle - currentFp.angle;
 
-		char buffer[1024];
-		sprintf(buffer, "%lld;%.16le;%.16le;%.16le;%.16le;%.16le;%.16le;%.16le;%.16le;%.16le\n", (long long int)currentFp.timeStamp, currentFp.x, averageX, normalizedFp.x, currentFp.y, averageY, normalizedFp.y, currentFp.angle, averageAngle, normalizedFp.angle);
-		fileOut.write(buffer);
+		if (isCsvOutput)
+		{
+			char buffer[1024];
+			sprintf(buffer, "%lld;%.16le;%.16le;%.16le;%.16le;%.16le;%.16le;%.16le;%.16le;%.16le\n", (long long int)currentFp.timeStamp, currentFp.x, averageX, normalizedFp.x, currentFp.y, averageY, normalizedFp.y, currentFp.angle, averageAngle, normalizedFp.angle);
+			csvFile.write(buffer);
+		}
+		else if (!outputDataFile.write(normalizedFp))
+			return false;
 	}
+
+	if (isCsvOutput)
+		csvFile.close();
+	else if (!outputDataFile.finish())
+		return false;
+
+	return true;
 }
 
 bool VideoStabilizer::readNormalizedFramePositions(const QString& fileName)
+{
+	// the binary data is used straight from the memory mapping
+	if (StabilizationDataFile::isBinaryFile(fileName))
+	{
+		if (!normalizedDataFile.open(fileName, StabilizationDataType::NormalizedFramePositions))
+			return false;
+
+		normalizedFramePositions = normalizedDataFile.getFramePositions();
+		normalizedFramePositionCount = normalizedDataFile.getFramePositionCount();
+
+		return true;
+	}
+
+	if (!readCsvFramePositions(fileName, 10, 3, 6, 9, csvNormalizedFramePositions))
+		return false;
+
+	normalizedFramePositions = csvNormalizedFramePositions.data();
+	normalizedFramePositionCount = csvNormalizedFramePositions.size();
+
+	return true;
+}
+
+// Reads the time stamps and the given columns of the CSV files written for debugging (or by older versions).
+bool VideoStabilizer::readCsvFramePositions(const QString& fileName, int columnCount, int xColumn, int yColumn, int angleColumn, std::vector<FramePosition>& framePositions)
 {
 	QFile file(fileName);
 
@@ -257,16 +657,16 @@ bool VideoStabilizer::readNormalizedFramePositions(const QString& fileName)
 	{
 		QStringList parts = lines.at(i).split(';');
 
-		if (parts.size() == 10)
+		if (parts.size() == columnCount)
 		{
 			FramePosition fp;
 
 			fp.timeStamp = (int64_t)parts[0].toLongLong();
-			fp.x = parts[3].toDouble();
-			fp.y = parts[6].toDouble();
-			fp.angle = parts[9].toDouble();
+			fp.x = parts[xColumn].toDouble();
+			fp.y = parts[yColumn].toDouble();
+			fp.angle = parts[angleColumn].toDouble();
 
-			normalizedFramePositions.push_back(fp);
+			framePositions.push_back(fp);
 		}
 	}
 
@@ -279,6 +679,12 @@ void VideoStabilizer::toggleEnabled()
 	reset();
 }
 
+// Only the real-time and the lookahead modes look at the images, the preprocessed and the gyro modes just need the time stamps.
+bool VideoStabilizer::getIsGrayscaleRequested() const
+{
+	return (isEnabled && (mode == VideoStabilizerMode::RealTime || mode == VideoStabilizerMode::Lookahead));
+}
+
 void VideoStabilizer::reset()
 {
 	cumulativeX = 0.0;
@@ -291,6 +697,22 @@ void VideoStabilizer::reset()
 
 	normalizedFramePosition = FramePosition();
 	previousTransformation = cv::Mat::eye(2, 3, CV_64F);
+	previousMotion = FramePosition();
+	hasPreviousImage = false;
+	isPreviousImageTracked = false;
+
+	skippedFrameCount = 0;
+	lastEstimatedFramePosition = FramePosition();
+	motionPerFrame = FramePosition();
+
+	keyFramePositions.clear();
+	pendingFramePositions.clear();
+	preProcessedFrameCount = 0;
+
+	lookaheadFramePositions.clear();
+	lookaheadSum = FramePosition();
+	lookaheadFirstIndex = 0;
+	lookaheadOutputIndex = 0;
 
 	isFirstImage = true;
 	lastProcessTime = 0.0;
@@ -315,3 +737,108 @@ double VideoStabilizer::getLastProcessTime() const
 {
 	return lastProcessTime;
 }
+
+// Runs the motion sources which look at the images over the same frames of the clip and compares them to the optical flow.
+void VideoStabilizer::runBenchmark(const QString& videoFilePath)
+{
+	const int maxFrameCount = 300;
+
+	Settings settings;
+	settings.video.inputVideoFilePath = videoFilePath;
+
+	VideoDecoder videoDecoder;
+
+	if (!videoDecoder.initialize(&settings, VideoDecoderProfile::FullQuality))
+		return;
+
+	std::vector<cv::Mat> images;
+	std::vector<FrameData> frames;
+
+	while ((int)frames.size() < maxFrameCount)
+	{
+		FrameData frameDataGrayscale;
+
+		if (!videoDecoder.getNextFrame(nullptr, &frameDataGrayscale))
+			break;
+
+		images.push_back(cv::Mat(frameDataGrayscale.height, frameDataGrayscale.width, CV_8UC1, frameDataGrayscale.data, frameDataGrayscale.rowLength).clone());
+
+		frameDataGrayscale.data = images.back().data;
+		frameDataGrayscale.rowLength = images.back().step;
+		frames.push_back(frameDataGrayscale);
+	}
+
+	if (frames.size() < 2)
+	{
+		qWarning("Could not read benchmark frames");
+		return;
+	}
+
+	struct BenchmarkCase
+	{
+		const char* name;
+		StabilizerMotionSource motionSource;
+		int motionEstimationInterval;
+	};
+
+	// the first one is the reference for the others
+	const BenchmarkCase benchmarkCases[] =
+	{
+		{ "optical flow", StabilizerMotionSource::OpticalFlow, 1 },
+		{ "optical flow on every 4th frame", StabilizerMotionSource::OpticalFlow, 4 },
+		{ "phase correlation", StabilizerMotionSource::PhaseCorrelation, 1 }
+	};
+
+	qDebug("Video stabilizer benchmark (%d frames of %dx%d)", (int)frames.size(), frames[0].width, frames[0].height);
+
+	std::vector<FramePosition> referencePositions;
+
+	for (const BenchmarkCase& benchmarkCase : benchmarkCases)
+	{
+		settings.stabilizer.motionSource = benchmarkCase.motionSource;
+		settings.stabilizer.motionEstimationInterval = benchmarkCase.motionEstimationInterval;
+
+		VideoStabilizer videoStabilizer;
+
+		if (!videoStabilizer.initialize(&settings, true))
+			return;
+
+		std::vector<FramePosition> positions;
+
+		QElapsedTimer timer;
+		timer.start();
+
+		for (const FrameData& frame : frames)
+			videoStabilizer.preProcessFrame(frame, false, positions);
+
+		videoStabilizer.finishPreProcessing(positions);
+
+		double averageTime = timer.nsecsElapsed() / 1000000.0 / frames.size();
+
+		if (referencePositions.empty())
+		{
+			referencePositions = positions;
+			qDebug("%s: %.2f ms per frame", benchmarkCase.name, averageTime);
+			continue;
+		}
+
+		// compare the frame to frame motion in pixels
+		double sumSquaredDifference = 0.0;
+		double sumReferenceMotion = 0.0;
+
+		for (size_t i = 1; i < positions.size(); ++i)
+		{
+			double referenceDeltaX = (referencePositions[i].x - referencePositions[i - 1].x) * frames[i].width;
+			double referenceDeltaY = (referencePositions[i].y - referencePositions[i - 1].y) * frames[i].height;
+			double deltaX = (positions[i].x - positions[i - 1].x) * frames[i].width;
+			double deltaY = (positions[i].y - positions[i - 1].y) * frames[i].height;
+
+			sumSquaredDifference += (deltaX - referenceDeltaX) * (deltaX - referenceDeltaX) + (deltaY - referenceDeltaY) * (deltaY - referenceDeltaY);
+			sumReferenceMotion += sqrt(referenceDeltaX * referenceDeltaX + referenceDeltaY * referenceDeltaY);
+		}
+
+		size_t deltaCount = positions.size() - 1;
+
+		qDebug("%s: %.2f ms per frame, %.3f px RMS difference to %s (%.3f px average motion)", benchmarkCase.name, averageTime, sqrt(sumSquaredDifference / deltaCount), benchmarkCases[0].name, sumReferenceMotion / deltaCount);
+	}
+}
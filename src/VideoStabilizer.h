@@ -4,6 +4,7 @@
 #pragma once
 
 #include <cstdint>
+#include <deque>
 
 #include <QFile>
 #include <QElapsedTimer>
@@ -11,6 +12,9 @@
 #include "opencv2/opencv.hpp"
 
 #include "MovingAverage.h"
+#include "FeatureTracker.h"
+#include "PhaseCorrelator.h"
+#include "StabilizationDataFile.h"
 
 namespace OrientView
 {
@@ -25,7 +29,9 @@ namespace OrientView
 		double angle = 0.0;
 	};
 
-	enum VideoStabilizerMode { RealTime, Preprocessed };
+	enum VideoStabilizerMode { RealTime, Preprocessed, Gyro, Lookahead };
+	enum StabilizerSmoothingType { WindowAverage, RecursiveGaussian };
+	enum StabilizerMotionSource { OpticalFlow, MotionVectors, PhaseCorrelation };
 
 	// Use the OpenCV library to do real-time video stabilization.
 	class VideoStabilizer
@@ -35,13 +41,19 @@ namespace OrientView
 
 		bool initialize(Settings* settings, bool isPreprocessing);
 
-		void preProcessFrame(const FrameData& frameDataGrayscale, QFile& file);
+		void preProcessFrame(const FrameData& frameDataGrayscale, bool isLastFrame, std::vector<FramePosition>& framePositions);
+		void finishPreProcessing(std::vector<FramePosition>& framePositions);
 		void processFrame(const FrameData& frameDataGrayscale);
 
-		static void convertCumulativeFramePositionsToNormalized(QFile& fileIn, QFile& fileOut, int smoothingRadius);
+		void addLookaheadFrame(const FrameData& frameDataGrayscale);
+		void processLookaheadFrame();
+		int getLookaheadFrameCount() const;
+
+		static bool convertCumulativeFramePositionsToNormalized(const QString& inputFileName, const QString& outputFileName, StabilizerSmoothingType smoothingType, int smoothingRadius);
 		bool readNormalizedFramePositions(const QString& fileName);
 
 		void toggleEnabled();
+		bool getIsGrayscaleRequested() const;
 		void reset();
 
 		double getX() const;
@@ -50,19 +62,54 @@ namespace OrientView
 
 		double getLastProcessTime() const;
 
+		static void runBenchmark(const QString& videoFilePath);
+
 	private:
 
+		struct KeyFramePosition
+		{
+			int64_t frameIndex = 0;
+			FramePosition framePosition;
+		};
+
+		void limitNormalizedFramePosition();
+		bool getIsMotionEstimationNeeded() const;
+		FramePosition estimateFramePosition(const FrameData& frameDataGrayscale);
+		FramePosition skipFramePosition(const FrameData& frameDataGrayscale);
+		FramePosition getKeyFrameTangent(size_t index) const;
+		void writeInterpolatedFramePositions(size_t index, std::vector<FramePosition>& framePositions);
 		FramePosition calculateCumulativeFramePosition(const FrameData& frameDataGrayscale);
+		FramePosition addFramePosition(const FrameData& frameDataGrayscale, double deltaX, double deltaY, double deltaAngle);
 		FramePosition searchNormalizedFramePosition(const FrameData& frameDataGrayscale);
+		bool readGyroFramePositions(Settings* settings);
+		FramePosition searchGyroFramePosition(const FrameData& frameDataGrayscale);
+		static bool readCsvFramePositions(const QString& fileName, int columnCount, int xColumn, int yColumn, int angleColumn, std::vector<FramePosition>& framePositions);
 
 		VideoStabilizerMode mode = VideoStabilizerMode::Preprocessed;
+		StabilizerMotionSource motionSource = StabilizerMotionSource::OpticalFlow;
 
 		bool isFirstImage = true;
 		bool isEnabled = true;
 
+		int motionEstimationInterval = 1;
+		double motionEstimationThreshold = 0.0;
+		int64_t skippedFrameCount = 0; // since the last estimated frame
+		FramePosition lastEstimatedFramePosition;
+		FramePosition motionPerFrame; // between the last two estimated frames
+
+		std::vector<KeyFramePosition> keyFramePositions; // the last estimated frames, the skipped frames between them are interpolated
+		std::vector<FramePosition> pendingFramePositions; // from the first key frame on, waiting for the interpolation
+		int64_t preProcessedFrameCount = 0;
+
+		std::deque<FramePosition> lookaheadFramePositions; // cumulative, the centred window around the frame that comes out next
+		FramePosition lookaheadSum;
+		int64_t lookaheadFirstIndex = 0; // frame index of the first position in the window
+		int64_t lookaheadOutputIndex = 0;
+
 		double dampingFactor = 0.0;
 		double maxDisplacementFactor = 0.0;
 		double maxAngle = 5.0;
+		int smoothingRadius = 0;
 
 		double cumulativeX = 0.0;
 		double cumulativeY = 0.0;
@@ -72,12 +119,23 @@ namespace OrientView
 		MovingAverage cumulativeYAverage;
 		MovingAverage cumulativeAngleAverage;
 
-		std::vector<FramePosition> normalizedFramePositions;
+		StabilizationDataFile normalizedDataFile;
+		std::vector<FramePosition> csvNormalizedFramePositions;
+		const FramePosition* normalizedFramePositions = nullptr; // sorted by the time stamps
+		size_t normalizedFramePositionCount = 0;
+
+		std::vector<FramePosition> gyroFramePositions; // normalized, one per frame from the start of the video
+		double gyroFrameRate = 0.0;
 
 		FramePosition normalizedFramePosition;
 
-		cv::Mat previousImage;
+		FeatureTracker featureTracker;
+		PhaseCorrelator phaseCorrelator;
+		cv::Mat previousImage; // only kept when the next frame is expected to come without the motion vectors
+		bool hasPreviousImage = false;
+		bool isPreviousImageTracked = false; // the feature tracker already holds the previous image
 		cv::Mat previousTransformation;
+		FramePosition previousMotion; // the change of the position on the previous frame
 
 		QElapsedTimer processTimer;
 		double lastProcessTime = 0.0;
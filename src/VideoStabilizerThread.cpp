@@ -1,48 +1,331 @@
 // Copyright © 2014 Mikko Ronkainen <firstname@mikkoronkainen.com>
 // License: GPLv3, see the LICENSE file.
 
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <limits>
+
 #include "VideoStabilizerThread.h"
-#include "VideoDecoder.h"
-#include "VideoStabilizer.h"
 #include "Settings.h"
 #include "FrameData.h"
 
 using namespace OrientView;
 
-bool VideoStabilizerThread::initialize(VideoDecoder* videoDecoder, VideoStabilizer* videoStabilizer, Settings* settings)
+namespace
 {
-	this->videoDecoder = videoDecoder;
-	this->videoStabilizer = videoStabilizer;
+	const double minSegmentDuration = 10.0; // seconds
+
+	class SegmentThread : public QThread
+	{
+
+	public:
+
+		explicit SegmentThread(const std::function<void()>& function) : function(function) {}
+
+	protected:
+
+		void run() { function(); }
+
+	private:
 
-	outputFile.setFileName(settings->stabilizer.passOneOutputFilePath);
+		std::function<void()> function;
+	};
+}
+
+bool VideoStabilizerThread::initialize(VideoDecoder* videoDecoder, VideoStabilizer* videoStabilizer, Settings* settings, VideoDecoderProfile videoDecoderProfile)
+{
+	isCsvOutput = StabilizationDataFile::isCsvFileName(settings->stabilizer.passOneOutputFilePath);
 
-	if (!outputFile.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+	if (isCsvOutput)
 	{
-		qWarning("Could not open output file");
-		return false;
+		outputFile.setFileName(settings->stabilizer.passOneOutputFilePath);
+
+		if (!outputFile.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+		{
+			qWarning("Could not open output file");
+			return false;
+		}
+
+		outputFile.write("timeStamp;cumulativeX;cumulativeY;cumulativeAngle\n");
 	}
+	else
+	{
+		StabilizationDataHeader sourceHeader = StabilizationDataFile::getSourceHeader(settings->video.inputVideoFilePath, videoDecoder->getFrameRateNum(), videoDecoder->getFrameRateDen());
+
+		if (!outputDataFile.create(settings->stabilizer.passOneOutputFilePath, StabilizationDataType::CumulativeFramePositions, sourceHeader))
+			return false;
+	}
+
+	halfFrameDuration = videoDecoder->getFrameDuration() / 2000.0;
+
+	int segmentCount = settings->stabilizer.passOneSegmentCount;
+
+	if (segmentCount <= 0)
+		segmentCount = QThread::idealThreadCount();
+
+	double duration = videoDecoder->getTotalFrameCount() * videoDecoder->getFrameDuration() / 1000.0;
+	segmentCount = std::max(1, std::min(segmentCount, (int)(duration / minSegmentDuration)));
+
+	// the segments start at keyframes, so the decoders can start without decoding anything extra
+	std::vector<double> startTimes;
+	startTimes.push_back(0.0);
+
+	for (int i = 1; i < segmentCount; ++i)
+	{
+		double startTime = videoDecoder->getKeyframeTime(duration * i / segmentCount);
+
+		if (startTime > startTimes.back())
+			startTimes.push_back(startTime);
+	}
+
+	// the segment decoders share the cores between them
+	Settings segmentSettings = *settings;
+	segmentSettings.video.decoderThreadCount = std::max(1, QThread::idealThreadCount() / (int)startTimes.size());
+
+	segments.resize(startTimes.size());
+
+	for (size_t i = 0; i < segments.size(); ++i)
+	{
+		Segment& segment = segments[i];
+
+		segment.startTime = startTimes[i];
+		segment.endTime = (i + 1 < startTimes.size()) ? startTimes[i + 1] : std::numeric_limits<double>::max();
+
+		// a single segment uses the decoder given by the caller, otherwise every segment gets a decoder with its share of the threads
+		if (segments.size() == 1)
+			segment.videoDecoder = videoDecoder;
+		else
+		{
+			segment.videoDecoder = new VideoDecoder();
+			segment.ownsDecoder = true;
+
+			if (!segment.videoDecoder->initialize(&segmentSettings, videoDecoderProfile))
+			{
+				qWarning("Could not initialize segment video decoder");
+				return false;
+			}
+		}
+
+		// the first segment is run on this thread with the stabilizer given by the caller
+		if (i == 0)
+		{
+			segment.videoStabilizer = videoStabilizer;
+			continue;
+		}
+
+		segment.videoStabilizer = new VideoStabilizer();
+		segment.ownsStabilizer = true;
+
+		if (!segment.videoStabilizer->initialize(&segmentSettings, true))
+		{
+			qWarning("Could not initialize segment video stabilizer");
+			return false;
+		}
+	}
+
+	qDebug("Running stabilizer pass one in %d segment(s)", (int)segments.size());
 
-	outputFile.write("timeStamp;cumulativeX;cumulativeY;cumulativeAngle\n");
 	return true;
 }
 
+VideoStabilizerThread::~VideoStabilizerThread()
+{
+	for (Segment& segment : segments)
+	{
+		if (segment.ownsStabilizer && segment.videoStabilizer != nullptr)
+		{
+			delete segment.videoStabilizer;
+			segment.videoStabilizer = nullptr;
+		}
+
+		if (segment.ownsDecoder && segment.videoDecoder != nullptr)
+		{
+			delete segment.videoDecoder;
+			segment.videoDecoder = nullptr;
+		}
+	}
+}
+
 void VideoStabilizerThread::run()
+{
+	std::vector<SegmentThread*> segmentThreads;
+
+	for (size_t i = 1; i < segments.size(); ++i)
+	{
+		Segment& segment = segments[i];
+
+		SegmentThread* segmentThread = new SegmentThread([this, &segment]() { processSegment(segment); });
+		segmentThread->start();
+		segmentThreads.push_back(segmentThread);
+	}
+
+	if (!segments.empty())
+		processSegment(segments[0]);
+
+	// keep the progress going while the rest of the segments finish
+	for (SegmentThread* segmentThread : segmentThreads)
+	{
+		while (!segmentThread->wait(100))
+			emit frameProcessed(processedFrameCount.load());
+
+		delete segmentThread;
+	}
+
+	// a partial file would look like a complete one to the pass two
+	if (isCsvOutput)
+	{
+		outputFile.close();
+
+		if (hasWriteError)
+			outputFile.remove();
+	}
+	else if (hasWriteError || !outputDataFile.finish())
+	{
+		hasWriteError = true;
+		outputDataFile.discard();
+	}
+
+	if (hasWriteError)
+		emit processingFailed("Could not write the stabilization data file");
+	else
+		emit processingFinished();
+}
+
+// Can be run on any thread, the segments only share the output.
+void VideoStabilizerThread::processSegment(Segment& segment)
 {
 	FrameData frameDataGrayscale;
+	std::vector<FramePosition> framePositions;
+
+	if (segment.startTime > 0.0)
+		segment.videoDecoder->seekAbsolute(segment.startTime);
+
+	bool isFirstSegment = (&segment == &segments[0]);
+	bool isCompleted = false;
 
 	while (!isInterruptionRequested())
 	{
-		if (videoDecoder->getNextFrame(nullptr, &frameDataGrayscale))
+		if (segment.videoDecoder->getNextFrame(nullptr, &frameDataGrayscale))
 		{
-			videoStabilizer->preProcessFrame(frameDataGrayscale, outputFile);
-			emit frameProcessed(frameDataGrayscale.cumulativeNumber);
+			// the first frame of the next segment is processed here as well, it ties the two segments together
+			bool isLastFrame = (frameDataGrayscale.time >= segment.endTime - halfFrameDuration);
+
+			framePositions.clear();
+			segment.videoStabilizer->preProcessFrame(frameDataGrayscale, isLastFrame, framePositions);
+			addFramePositions(segment, framePositions);
+
+			int frameCount = processedFrameCount.fetchAndAddOrdered(1) + 1;
+
+			if (isFirstSegment)
+				emit frameProcessed(frameCount);
+
+			if (isLastFrame)
+			{
+				isCompleted = true;
+				break;
+			}
 		}
-		else if (videoDecoder->getIsFinished())
+		else if (segment.videoDecoder->getIsFinished())
+		{
+			isCompleted = true;
 			break;
+		}
 	}
 
-	if (outputFile.isOpen())
-		outputFile.close();
+	framePositions.clear();
+	segment.videoStabilizer->finishPreProcessing(framePositions);
+	addFramePositions(segment, framePositions);
+
+	// an interrupted segment leaves a gap, so the ones after it are never written
+	if (isCompleted)
+		completeSegment(segment);
+}
+
+void VideoStabilizerThread::addFramePositions(Segment& segment, const std::vector<FramePosition>& framePositions)
+{
+	QMutexLocker locker(&outputMutex);
+
+	segment.framePositions.insert(segment.framePositions.end(), framePositions.begin(), framePositions.end());
+
+	if (writingSegmentIndex < segments.size() && &segment == &segments[writingSegmentIndex])
+		writeSegmentFramePositions(segment);
+}
+
+// The next segment takes over the writing and whatever it has waiting is written out, and the same for the ones after it if they are already done.
+void VideoStabilizerThread::completeSegment(Segment& segment)
+{
+	QMutexLocker locker(&outputMutex);
+
+	segment.isCompleted = true;
+
+	while (writingSegmentIndex < segments.size() && segments[writingSegmentIndex].isCompleted)
+	{
+		writingSegmentIndex++;
+
+		if (writingSegmentIndex < segments.size())
+			writeSegmentFramePositions(segments[writingSegmentIndex]);
+	}
+}
+
+// Continues the segment from where the previous one was at their shared frame. Has to be called with the output mutex locked.
+void VideoStabilizerThread::writeSegmentFramePositions(Segment& segment)
+{
+	for (const FramePosition& framePosition : segment.framePositions)
+	{
+		if (!segment.hasOffset)
+		{
+			segment.hasOffset = true;
+
+			if (hasWrittenFramePosition)
+			{
+				segment.offset.x = lastWrittenFramePosition.x - framePosition.x;
+				segment.offset.y = lastWrittenFramePosition.y - framePosition.y;
+				segment.offset.angle = lastWrittenFramePosition.angle - framePosition.angle;
+
+				// the shared frame is already there from the previous segment
+				if (framePosition.timeStamp == lastWrittenFramePosition.timeStamp)
+					continue;
+
+				qWarning("Could not find the frame shared by two stabilizer segments");
+			}
+		}
+
+		FramePosition fp = framePosition;
+
+		fp.x += segment.offset.x;
+		fp.y += segment.offset.y;
+		fp.angle += segment.offset.angle;
+
+		writeFramePosition(fp);
+	}
+
+	segment.framePositions.clear();
+}
+
+void VideoStabilizerThread::writeFramePosition(const FramePosition& framePosition)
+{
+	lastWrittenFramePosition = framePosition;
+	hasWrittenFramePosition = true;
+
+	if (hasWriteError)
+		return;
+
+	if (isCsvOutput)
+	{
+		char buffer[1024];
+		sprintf(buffer, "%lld;%.16le;%.16le;%.16le\n", (long long int)framePosition.timeStamp, framePosition.x, framePosition.y, framePosition.angle);
+
+		if (outputFile.write(buffer) < 0)
+		{
+			qWarning("Could not write output file: %s", qPrintable(outputFile.errorString()));
+			hasWriteError = true;
+		}
+	}
+	else if (!outputDataFile.write(framePosition))
+		hasWriteError = true;
 
-	emit processingFinished();
+	// there is no point in going on without the output
+	if (hasWriteError)
+		requestInterruption();
 }
@@ -3,27 +3,36 @@
 
 #pragma once
 
+#include <vector>
+
 #include <QThread>
 #include <QFile>
+#include <QAtomicInt>
+#include <QMutex>
+
+#include "VideoDecoder.h"
+#include "VideoStabilizer.h"
+#include "StabilizationDataFile.h"
 
 namespace OrientView
 {
-	class VideoDecoder;
-	class VideoStabilizer;
 	class Settings;
 
+	// Run the stabilizer pass one. The video is split into segments which are decoded and tracked in parallel, each with its own decoder and stabilizer.
 	class VideoStabilizerThread : public QThread
 	{
 		Q_OBJECT
 
 	public:
 
-		bool initialize(VideoDecoder* videoDecoder, VideoStabilizer* videoStabilizer, Settings* settings);
+		bool initialize(VideoDecoder* videoDecoder, VideoStabilizer* videoStabilizer, Settings* settings, VideoDecoderProfile videoDecoderProfile);
+		~VideoStabilizerThread();
 
 	signals:
 
 		void frameProcessed(int frameNumber);
 		void processingFinished();
+		void processingFailed(const QString& message);
 
 	protected:
 
@@ -31,9 +40,39 @@ namespace OrientView
 
 	private:
 
-		VideoDecoder* videoDecoder = nullptr;
-		VideoStabilizer* videoStabilizer = nullptr;
+		struct Segment
+		{
+			VideoDecoder* videoDecoder = nullptr;
+			VideoStabilizer* videoStabilizer = nullptr;
+			bool ownsDecoder = false;
+			bool ownsStabilizer = false;
+			double startTime = 0.0; // seconds
+			double endTime = 0.0; // seconds, the first frame at or after this is shared with the next segment
+			bool isCompleted = false;
+			std::vector<FramePosition> framePositions; // cumulative from the first frame of the segment, waiting for the segments before it to be written
+			FramePosition offset; // joins the segment to the end of the previous one
+			bool hasOffset = false;
+		};
+
+		void processSegment(Segment& segment);
+		void addFramePositions(Segment& segment, const std::vector<FramePosition>& framePositions);
+		void completeSegment(Segment& segment);
+		void writeSegmentFramePositions(Segment& segment);
+		void writeFramePosition(const FramePosition& framePosition);
+
+		std::vector<Segment> segments;
+		double halfFrameDuration = 0.0; // seconds
+		QAtomicInt processedFrameCount;
+
+		// the output is written by the segment threads in turns
+		QMutex outputMutex;
+		size_t writingSegmentIndex = 0; // the segment written as it goes, the later ones wait in memory
+		FramePosition lastWrittenFramePosition;
+		bool hasWrittenFramePosition = false;
+		bool hasWriteError = false;
 
-		QFile outputFile;
+		bool isCsvOutput = false;
+		QFile outputFile; // CSV for debugging
+		StabilizationDataFile outputDataFile;
 	};
 }